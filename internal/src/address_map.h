@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Map from object addresses to small values in one flat array with linear probing. Null is the empty marker, so it
+// cannot be a key. Erasing shifts the following entries back instead of leaving tombstones, so lookups never scan
+// further than the entries which collided. Only growing past half full allocates. Not synchronized.
+template <class Key, class Value>
+class AddressMap {
+public:
+  explicit AddressMap(size_t initial_capacity = 16) {
+    size_t capacity = 16;
+
+    while (capacity < initial_capacity * 2) {
+      capacity *= 2;
+      shift--;
+    }
+
+    entries.resize(capacity);
+  }
+
+  Value* find(Key key) {
+    for (size_t i = position_of(key); entries[i].key != nullptr; i = next(i)) {
+      if (entries[i].key == key) {
+        return &entries[i].value;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // Returns the value of the key, adding it with a default value if it is missing
+  Value& get_or_insert(Key key) {
+    if ((count + 1) * 2 > entries.size()) {
+      grow();
+    }
+
+    size_t i = position_of(key);
+
+    for (; entries[i].key != nullptr; i = next(i)) {
+      if (entries[i].key == key) {
+        return entries[i].value;
+      }
+    }
+
+    entries[i] = { key, Value() };
+    count++;
+    return entries[i].value;
+  }
+
+  bool erase(Key key) {
+    size_t hole = position_of(key);
+
+    while (entries[hole].key != key) {
+      if (entries[hole].key == nullptr) {
+        return false;
+      }
+
+      hole = next(hole);
+    }
+
+    // Moves back every following entry of the run which could not be found anymore past the hole
+    for (size_t i = next(hole); entries[i].key != nullptr; i = next(i)) {
+      size_t home = position_of(entries[i].key);
+
+      if (((i - home) & mask()) >= ((i - hole) & mask())) {
+        entries[hole] = entries[i];
+        hole = i;
+      }
+    }
+
+    entries[hole] = { nullptr, Value() };
+    count--;
+    return true;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+private:
+  struct Entry {
+    Key key;
+    Value value;
+  };
+
+  size_t mask() const {
+    return entries.size() - 1;
+  }
+
+  size_t next(size_t index) const {
+    return (index + 1) & mask();
+  }
+
+  size_t position_of(Key key) const {
+    // Objects are at least 16 byte aligned, the multiply spreads the remaining bits over the top ones
+    uint64_t hash = ((uint64_t) key >> 4) * 0x9E3779B97F4A7C15ull;
+    return (size_t) (hash >> shift);
+  }
+
+  void grow() {
+    std::vector<Entry> previous(entries.size() * 2);
+    previous.swap(entries);
+    count = 0;
+    shift--;
+
+    for (const Entry& entry : previous) {
+      if (entry.key != nullptr) {
+        get_or_insert(entry.key) = entry.value;
+      }
+    }
+  }
+
+  std::vector<Entry> entries;
+  size_t count = 0;
+  // Takes the top bits of the hash, which the multiply mixes best
+  unsigned shift = 64 - 4;
+};
@@ -2,6 +2,7 @@
 #include "memory/executable_address_space.h"
 #include "logging/log.h"
 #include <fstream>
+#include <unordered_map>
 
 static WDepot** static_depot_pointer;
 
@@ -59,6 +60,71 @@ void bundle_format_file_directory(WDirectory *directory, std::wstring &path) {
   }
 }
 
+static std::string bundle_file_path(uint32_t file_index) {
+  WBundleDiskFile* file = bundle_file_find(file_index);
+
+  if (file == nullptr) {
+    return "<not found>";
+  }
+
+  std::wstring full_path;
+  bundle_format_file_directory(file->directory, full_path);
+  full_path.append(file->file_name.text);
+  return logger::wide(full_path);
+}
+
+static void append_string(std::vector<uint8_t>& response, const std::string& value) {
+  uint32_t length = value.length();
+
+  response.insert(response.end(), (uint8_t*) &length, (uint8_t*) &length + sizeof(length));
+  response.insert(response.end(), value.begin(), value.end());
+}
+
+// Resolves uint32_t count, uint32_t file_index[count] at once. The response starts with a table of bundle paths
+// (uint32_t count, then uint32_t length + bytes each) and then has uint32_t count entries of uint32_t bundle path
+// position in the table, or 0xFFFFFFFF if unknown, and uint32_t length + bytes of the file path.
+static void message_file_index_batch(uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+  if (message.size() < 4 || message.size() != 4 + (size_t) *(uint32_t*) &message[0] * 4) {
+    sender(2, std::vector<uint8_t>());
+    return;
+  }
+
+  uint32_t count = *(uint32_t*) &message[0];
+  auto file_indices = (const uint32_t*) &message[4];
+
+  std::unordered_map<WDiskBundle*, uint32_t> bundle_positions;
+  std::vector<uint8_t> bundles;
+  std::vector<uint8_t> files;
+
+  for (uint32_t i = 0; i < count; i++) {
+    WDiskBundle* bundle = bundle_file_identify(file_indices[i]);
+    uint32_t bundle_position = 0xFFFFFFFF;
+
+    if (bundle != nullptr) {
+      auto inserted = bundle_positions.emplace(bundle, (uint32_t) bundle_positions.size());
+      bundle_position = inserted.first->second;
+
+      if (inserted.second) {
+        append_string(bundles, logger::wide(bundle->absolute_path.text));
+      }
+    }
+
+    files.insert(files.end(), (uint8_t*) &bundle_position, (uint8_t*) &bundle_position + sizeof(bundle_position));
+    append_string(files, bundle_file_path(file_indices[i]));
+  }
+
+  uint32_t bundle_count = bundle_positions.size();
+
+  std::vector<uint8_t> response;
+  response.reserve(8 + bundles.size() + files.size());
+  response.insert(response.end(), (uint8_t*) &bundle_count, (uint8_t*) &bundle_count + sizeof(bundle_count));
+  response.insert(response.end(), bundles.begin(), bundles.end());
+  response.insert(response.end(), (uint8_t*) &count, (uint8_t*) &count + sizeof(count));
+  response.insert(response.end(), files.begin(), files.end());
+
+  sender(21, response);
+}
+
 static void custom_WBundleDataHandleReader_deconstructor(WBundleDataHandleReader* reader) {
   delete[] ((uint8_t*) reader->buffer);
   delete reader;
@@ -217,36 +283,15 @@ void bundles_setup(TcpServer* tcp_server, WrapperAddressSpace* wrapper_space) {
 
   tcp_server->add_handler(10, [] (uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
     std::string bundle_path("<not found>");
-    std::string file_path("<not found>");
 
     uint32_t file_index = *(uint32_t*) &message[0];
+    WDiskBundle* bundle = bundle_file_identify(file_index);
 
-    WXBundleManager& manager = *static_depot_pointer[0]->bundle_manager;
-
-    if (file_index > 0 && file_index < manager.file_count) {
-      WBundleDiskFile* file = manager.files[file_index];
-
-      if (file != nullptr) {
-        std::wstring full_path;
-        bundle_format_file_directory(file->directory, full_path);
-        full_path.append(file->file_name.text);
-        file_path = logger::wide(full_path);
-      }
+    if (bundle != nullptr) {
+      bundle_path = logger::wide(bundle->absolute_path.text);
     }
 
-    WXBundleFileIndex& index = *manager.file_index;
-
-    if (file_index < index.mapping_count) {
-      WXBundleFileMapping& mapping = index.mappings[file_index];
-
-      if (mapping.file_id != 0) {
-        WXBundleFileLocation& location = index.locations[mapping.file_id];
-
-        if (location.bundle_index < manager.bundle_count) {
-          bundle_path = logger::wide(manager.bundles[location.bundle_index]->absolute_path.text);
-        }
-      }
-    }
+    std::string file_path = bundle_file_path(file_index);
 
     const char* bundle_bytes = bundle_path.c_str();
     size_t bundle_bytes_length = strlen(bundle_bytes);
@@ -263,4 +308,6 @@ void bundles_setup(TcpServer* tcp_server, WrapperAddressSpace* wrapper_space) {
 
     sender(11, response);
   });
+
+  tcp_server->add_handler(20, message_file_index_batch);
 }
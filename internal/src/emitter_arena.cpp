@@ -0,0 +1,85 @@
+#include "emitter_arena.h"
+
+#include <algorithm>
+
+static WXBuffer<uint8_t>& list_at(WRenderParticleEmitter& emitter, uint32_t offset) {
+  return *reinterpret_cast<WXBuffer<uint8_t>*>(reinterpret_cast<uint8_t*>(&emitter) + offset);
+}
+
+uint8_t* EmitterArena::replace(WRenderParticleEmitter& emitter, uint32_t offset, uint32_t length, uint32_t item_size) {
+  WXBuffer<uint8_t>& list = list_at(emitter, offset);
+
+  auto found = std::find_if(replaced.begin(), replaced.end(), [offset] (const Replaced& entry) {
+    return entry.offset == offset;
+  });
+
+  if (found == replaced.end()) {
+    replaced.push_back({ offset, list });
+  }
+
+  list.data = length > 0 ? allocate((size_t) length * item_size) : nullptr;
+  list.length = length;
+  return list.data;
+}
+
+void EmitterArena::restore(WRenderParticleEmitter& emitter) {
+  for (const Replaced& entry : replaced) {
+    list_at(emitter, entry.offset) = entry.original;
+  }
+
+  replaced.clear();
+  block = 0;
+  used = 0;
+}
+
+bool EmitterArena::empty() const {
+  return replaced.empty();
+}
+
+uint8_t* EmitterArena::allocate(size_t size) {
+  // Items are at most vectors of floats, 16 bytes keeps them aligned for copies of any width
+  size = (size + 15) & ~(size_t) 15;
+
+  for (; block < blocks.size(); block++, used = 0) {
+    if (blocks[block].size - used >= size) {
+      uint8_t* result = blocks[block].data.get() + used;
+      used += size;
+      return result;
+    }
+  }
+
+  size_t block_size = std::max(size, (size_t) 0x1000);
+  blocks.push_back({ std::make_unique<uint8_t[]>(block_size), block_size });
+  used = size;
+  return blocks.back().data.get();
+}
+
+EmitterArena& EmitterArenas::acquire(WRenderParticleEmitter* render_emitter) {
+  std::lock_guard<std::mutex> guard(lock);
+  EmitterArena*& arena = arenas.get_or_insert(render_emitter);
+
+  if (arena == nullptr) {
+    if (recycled.empty()) {
+      owned.push_back(std::make_unique<EmitterArena>());
+      recycled.push_back(owned.back().get());
+    }
+
+    arena = recycled.back();
+    recycled.pop_back();
+  }
+
+  return *arena;
+}
+
+void EmitterArenas::release(WRenderParticleEmitter* render_emitter) {
+  std::lock_guard<std::mutex> guard(lock);
+  EmitterArena** arena = arenas.find(render_emitter);
+
+  if (arena == nullptr) {
+    return;
+  }
+
+  (*arena)->restore(*render_emitter);
+  recycled.push_back(*arena);
+  arenas.erase(render_emitter);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "engine_types.h"
+#include "address_map.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Storage for the lists which replaced those of one emitter. The replaced lists are remembered and put back before the
+// engine frees the emitter or parses into it, so the engine only ever frees memory it allocated itself. Storage of a
+// list replaced twice is only reused after restoring, which keeps the blocks for the next emitter. Not synchronized.
+class EmitterArena {
+public:
+  // Points the list at the given offset in the emitter to new storage for length items of item_size bytes
+  uint8_t* replace(WRenderParticleEmitter& emitter, uint32_t offset, uint32_t length, uint32_t item_size);
+
+  // Puts the engine's lists back into the emitter and forgets the storage
+  void restore(WRenderParticleEmitter& emitter);
+
+  bool empty() const;
+
+private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  struct Replaced {
+    uint32_t offset;
+    WXBuffer<uint8_t> original;
+  };
+
+  uint8_t* allocate(size_t size);
+
+  std::vector<Block> blocks;
+  size_t block = 0;
+  size_t used = 0;
+  std::vector<Replaced> replaced;
+};
+
+// Arenas of the emitters which had lists replaced, recycled once the engine is done with the emitter
+class EmitterArenas {
+public:
+  // Takes a recycled arena if the emitter has none yet. Only called while the emitter is known to be alive.
+  EmitterArena& acquire(WRenderParticleEmitter* render_emitter);
+
+  // Puts the engine's lists back and recycles the arena, does nothing if the emitter has none
+  void release(WRenderParticleEmitter* render_emitter);
+
+private:
+  std::mutex lock;
+  AddressMap<WRenderParticleEmitter*, EmitterArena*> arenas;
+  std::vector<std::unique_ptr<EmitterArena>> owned;
+  std::vector<EmitterArena*> recycled;
+};
@@ -0,0 +1,118 @@
+#include "emitter_edit.h"
+
+#include <cstring>
+
+// Reads the message front to back, every read fails once it would go past the end
+struct EditReader {
+  const std::vector<uint8_t>& message;
+  size_t position;
+
+  const uint8_t* take(size_t length) {
+    if (message.size() - position < length) {
+      return nullptr;
+    }
+
+    const uint8_t* result = message.data() + position;
+    position += length;
+    return result;
+  }
+
+  template <typename T>
+  bool read(T& value) {
+    const uint8_t* bytes = take(sizeof(T));
+
+    if (bytes == nullptr) {
+      return false;
+    }
+
+    std::memcpy(&value, bytes, sizeof(T));
+    return true;
+  }
+};
+
+// Fields usually come in schema order, so the search starts after the previous one
+static const EmitterField* find_field(const uint8_t* name, size_t length, size_t& next) {
+  const size_t count = sizeof(emitter_fields) / sizeof(emitter_fields[0]);
+
+  // Comparing stops at terminators, a name containing one could otherwise match a shorter field
+  if (std::memchr(name, 0, length) != nullptr) {
+    return nullptr;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const EmitterField& field = emitter_fields[(next + i) % count];
+
+    if (std::strncmp(field.name, (const char*) name, length) == 0 && field.name[length] == '\0') {
+      next = (next + i + 1) % count;
+      return &field;
+    }
+  }
+
+  return nullptr;
+}
+
+bool emitter_edit_decode(const std::vector<uint8_t>& message, EmitterEdit& edit) {
+  EditReader reader { message, 0 };
+  uint32_t count;
+  size_t next_field = 0;
+
+  edit.fields.clear();
+  edit.values.clear();
+
+  if (!reader.read(edit.handle) || !reader.read(count)) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint8_t name_length;
+    uint32_t items = 1;
+
+    if (!reader.read(name_length)) {
+      return false;
+    }
+
+    const uint8_t* name = reader.take(name_length);
+    const EmitterField* field = name != nullptr ? find_field(name, name_length, next_field) : nullptr;
+
+    if (field == nullptr || (emitter_field_is_list(field->kind) && !reader.read(items))) {
+      return false;
+    }
+
+    size_t size = (size_t) items * emitter_field_size(field->kind);
+    const uint8_t* value = reader.take(size);
+
+    if (value == nullptr) {
+      return false;
+    }
+
+    edit.fields.push_back({ field, items, edit.values.size() });
+    edit.values.insert(edit.values.end(), value, value + size);
+  }
+
+  return reader.position == message.size();
+}
+
+void emitter_edit_apply(const EmitterEdit& edit, WRenderParticleEmitter& emitter, EmitterArenas& arenas) {
+  auto base = reinterpret_cast<uint8_t*>(&emitter);
+
+  for (const EmitterEdit::Field& entry : edit.fields) {
+    uint32_t size = emitter_field_size(entry.field->kind);
+    const uint8_t* value = edit.values.data() + entry.value_offset;
+
+    if (!emitter_field_is_list(entry.field->kind)) {
+      std::memcpy(base + entry.field->offset, value, size);
+      continue;
+    }
+
+    auto& list = *reinterpret_cast<WXBuffer<uint8_t>*>(base + entry.field->offset);
+    uint8_t* items = list.data;
+
+    if (list.length != entry.items) {
+      items = arenas.acquire(&emitter).replace(emitter, entry.field->offset, entry.items, size);
+    }
+
+    if (entry.items > 0) {
+      std::memcpy(items, value, (size_t) entry.items * size);
+    }
+  }
+}
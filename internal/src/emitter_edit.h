@@ -0,0 +1,28 @@
+#pragma once
+
+#include "emitter_encoding.h"
+#include "emitter_arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Parameter changes for one emitter as sent with message type 40: uint64_t handle, uint32_t field count, then for each
+// field its uint8_t name length, the name as in the schema and the value. Values are as in message type 8, except that
+// lists start with a uint32_t item count and have no item cap. Decoding checks everything, so applying cannot fail.
+struct EmitterEdit {
+  struct Field {
+    const EmitterField* field;
+    uint32_t items;
+    size_t value_offset;
+  };
+
+  uint64_t handle = 0;
+  std::vector<Field> fields;
+  std::vector<uint8_t> values;
+};
+
+bool emitter_edit_decode(const std::vector<uint8_t>& message, EmitterEdit& edit);
+
+// Lists with another number of items get new storage from the arena of the emitter, the others are overwritten in place
+void emitter_edit_apply(const EmitterEdit& edit, WRenderParticleEmitter& emitter, EmitterArenas& arenas);
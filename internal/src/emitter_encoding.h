@@ -0,0 +1,257 @@
+#pragma once
+
+#include "engine_types.h"
+#include "server/message_builder.h"
+#include "fingerprint.h"
+
+#include <array>
+#include <cstddef>
+
+// Kinds of emitter fields as listed in the schema message. Lists are a uint32_t item count followed by the items,
+// everything else is sent as it is in memory.
+enum EmitterFieldKind : uint8_t {
+  emitter_field_uint8 = 1,
+  emitter_field_uint32,
+  emitter_field_uint64,
+  emitter_field_float,
+  emitter_field_vector3,
+  emitter_field_matrix,
+  emitter_field_float_list,
+  emitter_field_vector2_list,
+  emitter_field_vector3_list
+};
+
+struct EmitterField {
+  const char* name;
+  uint32_t offset;
+  EmitterFieldKind kind;
+};
+
+constexpr bool emitter_field_is_list(EmitterFieldKind kind) {
+  return kind >= emitter_field_float_list;
+}
+
+// Size of the value, or of one item for lists
+constexpr uint32_t emitter_field_size(EmitterFieldKind kind) {
+  switch (kind) {
+    case emitter_field_uint8: return 1;
+    case emitter_field_uint32: return 4;
+    case emitter_field_uint64: return 8;
+    case emitter_field_float: return 4;
+    case emitter_field_vector3: return 12;
+    case emitter_field_matrix: return 64;
+    case emitter_field_float_list: return 4;
+    case emitter_field_vector2_list: return 8;
+    case emitter_field_vector3_list: return 12;
+  }
+
+  return 0;
+}
+
+// Lists are copied in one go, which only works while the items have no padding
+static_assert(sizeof(WXVector2) == 8 && sizeof(WXVector3) == 12, "Emitter list items are not tightly packed");
+
+#define EMITTER_FIELD(name, kind) { #name, offsetof(WRenderParticleEmitter, name), kind }
+#define EMITTER_DATA_FIELD(name, kind) { #name, \
+    offsetof(WRenderParticleEmitter, emitter_data) + offsetof(WXParticleEmitterModuleData, name), kind }
+
+// Emitter details in the order they are sent in message type 8 after the found flag
+constexpr EmitterField emitter_fields[] = {
+    EMITTER_FIELD(initializer_bitset, emitter_field_uint32),
+    EMITTER_FIELD(modificator_bitset, emitter_field_uint32),
+    EMITTER_DATA_FIELD(alpha, emitter_field_float_list),
+    EMITTER_DATA_FIELD(color, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(lifetime, emitter_field_float_list),
+    EMITTER_DATA_FIELD(position, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(position_offset, emitter_field_float),
+    EMITTER_DATA_FIELD(rotation, emitter_field_float_list),
+    EMITTER_DATA_FIELD(rotation_3d, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(rotation_rate, emitter_field_float_list),
+    EMITTER_DATA_FIELD(rotation_rate_3d, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(size, emitter_field_vector2_list),
+    EMITTER_DATA_FIELD(size_3d, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(size_keep_ratio, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_extents, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(spawn_inner_radius, emitter_field_float_list),
+    EMITTER_DATA_FIELD(spawn_outer_radius, emitter_field_float_list),
+    EMITTER_DATA_FIELD(spawn_world_space, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_surface_only, emitter_field_uint8),
+    EMITTER_DATA_FIELD(p0A8, emitter_field_vector3),
+    EMITTER_DATA_FIELD(spawn_to_local_matrix, emitter_field_matrix),
+    EMITTER_DATA_FIELD(velocity, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(velocity_world_space, emitter_field_uint8),
+    EMITTER_DATA_FIELD(velocity_inherit_scale, emitter_field_float_list),
+    EMITTER_DATA_FIELD(velocity_spread_scale, emitter_field_float_list),
+    EMITTER_DATA_FIELD(velocity_spread_conserve_momentum, emitter_field_uint8),
+    EMITTER_DATA_FIELD(texture_animation_initial_frame, emitter_field_float_list),
+    EMITTER_DATA_FIELD(p140, emitter_field_uint32),
+    EMITTER_DATA_FIELD(p144, emitter_field_uint32),
+    EMITTER_DATA_FIELD(p148, emitter_field_uint32),
+    EMITTER_DATA_FIELD(velocity_over_life, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(acceleration_direction, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(acceleration_scale, emitter_field_float_list),
+    EMITTER_DATA_FIELD(rotation_over_life, emitter_field_float_list),
+    EMITTER_DATA_FIELD(rotation_rate_over_life, emitter_field_float_list),
+    EMITTER_DATA_FIELD(rotation_3d_over_life, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(rotation_rate_3d_over_life, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(color_over_life, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(alpha_over_life, emitter_field_float_list),
+    EMITTER_DATA_FIELD(size_over_life, emitter_field_vector2_list),
+    EMITTER_DATA_FIELD(size_over_life_orientation, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(texture_animation_speed, emitter_field_float_list),
+    EMITTER_DATA_FIELD(velocity_turbulize_scale, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(velocity_turbulize_timelife_limit, emitter_field_float_list),
+    EMITTER_DATA_FIELD(velocity_turbulize_noise_interval, emitter_field_float),
+    EMITTER_DATA_FIELD(velocity_turbulize_duration, emitter_field_float),
+    EMITTER_DATA_FIELD(target_force_scale, emitter_field_float_list),
+    EMITTER_DATA_FIELD(target_kill_radius, emitter_field_float_list),
+    EMITTER_DATA_FIELD(target_max_force, emitter_field_float),
+    EMITTER_DATA_FIELD(target_position, emitter_field_vector3_list),
+    EMITTER_DATA_FIELD(spawn_positive_x, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_negative_x, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_positive_y, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_negative_y, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_position_z, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_negative_z, emitter_field_uint8),
+    EMITTER_DATA_FIELD(spawn_velocity, emitter_field_uint8),
+    EMITTER_DATA_FIELD(collision_triggering_group_index, emitter_field_uint64),
+    EMITTER_DATA_FIELD(collision_dynamic_friction, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_static_friction, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_restitution, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_velocity_dampening, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_disable_gravity, emitter_field_uint8),
+    EMITTER_DATA_FIELD(collision_use_gpu, emitter_field_uint8),
+    EMITTER_DATA_FIELD(collision_radius, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_kill_when_collide, emitter_field_uint8),
+    EMITTER_DATA_FIELD(collision_self_emitter_index, emitter_field_uint32),
+    EMITTER_DATA_FIELD(collision_spawn_probability, emitter_field_float),
+    EMITTER_DATA_FIELD(collision_spawn_parent_emitter_index, emitter_field_uint32),
+    EMITTER_DATA_FIELD(alpha_by_distance_far, emitter_field_float),
+    EMITTER_DATA_FIELD(alpha_by_distance_near, emitter_field_float)
+};
+
+#undef EMITTER_FIELD
+#undef EMITTER_DATA_FIELD
+
+// Encoding reduced to copies: runs of fields which are next to each other both in the message and in memory become
+// one copy, a list becomes its count and one copy of all of its items.
+struct EmitterEncodeStep {
+  uint32_t offset;
+  // Bytes to copy, or the item size for a list
+  uint32_t length;
+  bool list;
+};
+
+template <size_t Count>
+struct EmitterEncodePlan {
+  std::array<EmitterEncodeStep, Count> steps {};
+  size_t count = 0;
+  // Everything except list items
+  size_t fixed_size = 0;
+};
+
+template <size_t Count>
+constexpr EmitterEncodePlan<Count> emitter_encode_plan(const EmitterField (&fields)[Count]) {
+  EmitterEncodePlan<Count> plan;
+
+  for (size_t i = 0; i < Count; i++) {
+    const EmitterField& field = fields[i];
+    uint32_t size = emitter_field_size(field.kind);
+
+    if (emitter_field_is_list(field.kind)) {
+      plan.steps[plan.count++] = { field.offset, size, true };
+      plan.fixed_size += sizeof(uint32_t);
+      continue;
+    }
+
+    EmitterEncodeStep* previous = plan.count > 0 ? &plan.steps[plan.count - 1] : nullptr;
+
+    if (previous != nullptr && !previous->list && previous->offset + previous->length == field.offset) {
+      previous->length += size;
+    } else {
+      plan.steps[plan.count++] = { field.offset, size, false };
+    }
+
+    plan.fixed_size += size;
+  }
+
+  return plan;
+}
+
+constexpr auto emitter_plan = emitter_encode_plan(emitter_fields);
+
+template <>
+struct MessageSerializer<WRenderParticleEmitter> {
+  static constexpr bool fixed = false;
+  static constexpr size_t fixed_size = 0;
+
+  static size_t size(const WRenderParticleEmitter& emitter) {
+    auto base = reinterpret_cast<const uint8_t*>(&emitter);
+    size_t size = emitter_plan.fixed_size;
+
+    for (size_t i = 0; i < emitter_plan.count; i++) {
+      const EmitterEncodeStep& step = emitter_plan.steps[i];
+
+      if (step.list) {
+        size += (size_t) reinterpret_cast<const WXBuffer<uint8_t>*>(base + step.offset)->length * step.length;
+      }
+    }
+
+    return size;
+  }
+
+  static void write(MessageWriter& writer, const WRenderParticleEmitter& emitter) {
+    auto base = reinterpret_cast<const uint8_t*>(&emitter);
+
+    for (size_t i = 0; i < emitter_plan.count; i++) {
+      const EmitterEncodeStep& step = emitter_plan.steps[i];
+
+      if (!step.list) {
+        writer.write(base + step.offset, step.length);
+        continue;
+      }
+
+      const auto& buffer = *reinterpret_cast<const WXBuffer<uint8_t>*>(base + step.offset);
+
+      writer.write(&buffer.length, sizeof(buffer.length));
+      writer.write(buffer.data, (size_t) buffer.length * step.length);
+    }
+  }
+};
+
+// Fingerprint of everything message 8 sends for the emitter, including the items of its lists
+inline uint64_t emitter_fingerprint(const WRenderParticleEmitter& emitter) {
+  auto base = reinterpret_cast<const uint8_t*>(&emitter);
+  Fingerprint fingerprint;
+
+  for (size_t i = 0; i < emitter_plan.count; i++) {
+    const EmitterEncodeStep& step = emitter_plan.steps[i];
+
+    if (!step.list) {
+      fingerprint.update(base + step.offset, step.length);
+      continue;
+    }
+
+    const auto& buffer = *reinterpret_cast<const WXBuffer<uint8_t>*>(base + step.offset);
+
+    fingerprint.update(&buffer.length, sizeof(buffer.length));
+    fingerprint.update(buffer.data, (size_t) buffer.length * step.length);
+  }
+
+  return fingerprint.value();
+}
+
+// Message 27: uint32_t field count, then for each field of message 8 in order its uint8_t kind and name
+inline std::vector<uint8_t> emitter_schema_message() {
+  std::vector<uint8_t> message;
+  uint32_t count = sizeof(emitter_fields) / sizeof(emitter_fields[0]);
+
+  message_append(message, count);
+
+  for (const EmitterField& field : emitter_fields) {
+    message_append(message, field.kind);
+    message_append_string(message, field.name);
+  }
+
+  return message;
+}
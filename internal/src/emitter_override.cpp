@@ -0,0 +1,89 @@
+#include "emitter_override.h"
+#include "emitter_encoding.h"
+
+#include <cstring>
+#include <algorithm>
+
+static const WXBuffer<uint8_t>& list_at(const WXParticleEmitterModuleData& data, uint32_t offset) {
+  return *reinterpret_cast<const WXBuffer<uint8_t>*>(reinterpret_cast<const uint8_t*>(&data) + offset);
+}
+
+EmitterOverride::EmitterOverride(emitter_config_parser_fn parser, const WMemoryFileReader& reader)
+    : parser(parser), reader(reader) {
+
+  const uint32_t data_offset = offsetof(WRenderParticleEmitter, emitter_data);
+  std::vector<Step> lists;
+
+  for (const EmitterField& field : emitter_fields) {
+    if (emitter_field_is_list(field.kind)) {
+      lists.push_back({ field.offset - data_offset, emitter_field_size(field.kind), true });
+    }
+  }
+
+  std::sort(lists.begin(), lists.end(), [] (const Step& left, const Step& right) {
+    return left.offset < right.offset;
+  });
+
+  // Every byte the parser may have written, including those the schema does not name, except for the list headers
+  uint32_t position = 0;
+
+  for (const Step& list : lists) {
+    if (list.offset > position) {
+      steps.push_back({ position, list.offset - position, false });
+    }
+
+    steps.push_back(list);
+    position = list.offset + sizeof(WXBuffer<uint8_t>);
+  }
+
+  if (position < sizeof(WXParticleEmitterModuleData)) {
+    steps.push_back({ position, (uint32_t) sizeof(WXParticleEmitterModuleData) - position, false });
+  }
+}
+
+void EmitterOverride::load(std::vector<uint8_t> new_config) {
+  config = std::move(new_config);
+
+  // Parsing into the same image again lets the engine reuse or free the lists of the previous config
+  parse(image);
+  has_image = true;
+}
+
+bool EmitterOverride::loaded() const {
+  return has_image;
+}
+
+bool EmitterOverride::apply(WXParticleEmitterModuleData& target) {
+  for (const Step& step : steps) {
+    if (step.list && list_at(target, step.offset).length != list_at(image, step.offset).length) {
+      parse(target);
+      return false;
+    }
+  }
+
+  auto source = reinterpret_cast<const uint8_t*>(&image);
+  auto destination = reinterpret_cast<uint8_t*>(&target);
+
+  for (const Step& step : steps) {
+    if (!step.list) {
+      std::memcpy(destination + step.offset, source + step.offset, step.length);
+      continue;
+    }
+
+    const WXBuffer<uint8_t>& from = list_at(image, step.offset);
+
+    if (from.length > 0) {
+      std::memcpy(list_at(target, step.offset).data, from.data, (size_t) from.length * step.length);
+    }
+  }
+
+  return true;
+}
+
+void EmitterOverride::parse(WXParticleEmitterModuleData& target) {
+  reader.buffer = config.data();
+  reader.size = config.size();
+  reader.position = 0;
+
+  parser(&reader, &target);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "engine_types.h"
+
+#include <cstdint>
+#include <vector>
+
+typedef void (*emitter_config_parser_fn)(WMemoryFileReader* reader, WXParticleEmitterModuleData* data);
+
+// Emitter parameters from an emitter config file, parsed by the engine once into an image which is then copied into
+// each emitter. Everything but the list headers is copied byte for byte, including what the schema does not name, so
+// that a copy leaves the same as parsing would. The engine owns the memory of the lists, so the items are only copied
+// into lists of the same length, and emitters with any list of another length get the config parsed by the engine
+// instead. Only used on the game thread.
+class EmitterOverride {
+public:
+  // The reader has the vtables of the engine's memory file reader, its buffer is pointed at the config when parsing
+  EmitterOverride(emitter_config_parser_fn parser, const WMemoryFileReader& reader);
+
+  void load(std::vector<uint8_t> config);
+  bool loaded() const;
+
+  // Returns true if the image was copied, false if the config had to be parsed again for this emitter
+  bool apply(WXParticleEmitterModuleData& target);
+
+private:
+  struct Step {
+    uint32_t offset;
+    // Bytes to copy, or the item size for a list
+    uint32_t length;
+    bool list;
+  };
+
+  void parse(WXParticleEmitterModuleData& target);
+
+  emitter_config_parser_fn parser;
+  WMemoryFileReader reader;
+  std::vector<uint8_t> config;
+  std::vector<Step> steps;
+  WXParticleEmitterModuleData image {};
+  bool has_image = false;
+};
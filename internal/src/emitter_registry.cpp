@@ -0,0 +1,241 @@
+#include "emitter_registry.h"
+#include "emitter_encoding.h"
+#include "server/message_builder.h"
+
+#include <algorithm>
+
+EmitterRegistry::Shard::Shard(size_t capacity, size_t change_log)
+    : emitter_files(capacity), render_emitter_handles(capacity), changes(std::max(change_log, (size_t) 1)) {
+
+  render_emitter_positions.reserve(capacity);
+  render_emitters.reserve(capacity);
+  emitters.reserve(capacity);
+  file_indices.reserve(capacity);
+  local_handles.reserve(capacity);
+  fingerprints.reserve(capacity);
+}
+
+EmitterRegistry::EmitterRegistry(size_t shard_count, size_t shard_capacity, size_t shard_change_log) {
+  for (size_t i = 0; i < std::max(shard_count, (size_t) 1); i++) {
+    shards.push_back(std::make_unique<Shard>(shard_capacity, shard_change_log));
+  }
+}
+
+size_t EmitterRegistry::shard_index(const void* address) const {
+  // Objects are at least 16 byte aligned, the multiply spreads the remaining bits over the top ones
+  uint64_t hash = ((uint64_t) address >> 4) * 0x9E3779B97F4A7C15ull;
+  return (hash >> 32) % shards.size();
+}
+
+// Called with the shard locked, which is what makes reading the version before locking a shard safe
+void EmitterRegistry::record_change(Shard& shard, bool added, uint32_t position, uint64_t handle) {
+  uint8_t kind = added ? 1 : 0;
+  uint32_t file_index = shard.file_indices[position];
+
+  message_append(shard.events, kind);
+  message_append(shard.events, handle);
+  message_append(shard.events, file_index);
+  shard.event_count++;
+
+  EmitterChange& change = shard.changes[shard.change_count++ % shard.changes.size()];
+
+  if (shard.change_count > shard.changes.size()) {
+    shard.dropped_version = change.version;
+  }
+
+  change = { current_version.fetch_add(1) + 1, handle, file_index, added };
+}
+
+void EmitterRegistry::track_emitter(WParticleEmitter* emitter, uint32_t file_index) {
+  Shard& shard = *shards[shard_index(emitter)];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  shard.emitter_files.get_or_insert(emitter) = file_index;
+}
+
+void EmitterRegistry::untrack_emitter(WParticleEmitter* emitter) {
+  Shard& shard = *shards[shard_index(emitter)];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  shard.emitter_files.erase(emitter);
+}
+
+TrackedRenderParticleEmitter EmitterRegistry::register_render_emitter(WRenderParticleEmitter* render_emitter,
+                                                                      WParticleEmitter* emitter) {
+  TrackedRenderParticleEmitter tracked { render_emitter, emitter, 0, 0 };
+
+  // The two usually live in different shards, only one is locked at a time
+  {
+    Shard& shard = *shards[shard_index(emitter)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    const uint32_t* file_index = shard.emitter_files.find(emitter);
+
+    if (file_index == nullptr) {
+      return tracked;
+    }
+
+    tracked.file_index = *file_index;
+  }
+
+  size_t index = shard_index(render_emitter);
+  Shard& shard = *shards[index];
+  std::lock_guard<std::mutex> guard(shard.lock);
+  uint64_t& local_handle = shard.render_emitter_handles.get_or_insert(render_emitter);
+  uint32_t position;
+
+  if (local_handle == 0) {
+    position = (uint32_t) shard.render_emitters.size();
+    local_handle = shard.render_emitter_positions.insert(position);
+
+    shard.render_emitters.push_back(render_emitter);
+    shard.emitters.push_back(emitter);
+    shard.file_indices.push_back(tracked.file_index);
+    shard.local_handles.push_back(local_handle);
+    shard.fingerprints.push_back(0);
+    render_emitter_count.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    position = *shard.render_emitter_positions.find(local_handle);
+
+    shard.emitters[position] = emitter;
+    shard.file_indices[position] = tracked.file_index;
+    shard.fingerprints[position] = 0;
+  }
+
+  tracked.handle = global_handle(index, shards.size(), local_handle);
+  record_change(shard, true, position, tracked.handle);
+  return tracked;
+}
+
+void EmitterRegistry::unregister_render_emitter(WRenderParticleEmitter* render_emitter) {
+  size_t index = shard_index(render_emitter);
+  Shard& shard = *shards[index];
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  const uint64_t* found = shard.render_emitter_handles.find(render_emitter);
+
+  if (found == nullptr) {
+    return;
+  }
+
+  uint64_t local_handle = *found;
+  uint32_t position = *shard.render_emitter_positions.find(local_handle);
+  auto last = (uint32_t) (shard.render_emitters.size() - 1);
+
+  record_change(shard, false, position, global_handle(index, shards.size(), local_handle));
+
+  shard.render_emitter_positions.erase(local_handle);
+  shard.render_emitter_handles.erase(render_emitter);
+
+  if (position != last) {
+    shard.render_emitters[position] = shard.render_emitters[last];
+    shard.emitters[position] = shard.emitters[last];
+    shard.file_indices[position] = shard.file_indices[last];
+    shard.local_handles[position] = shard.local_handles[last];
+    shard.fingerprints[position] = shard.fingerprints[last];
+
+    *shard.render_emitter_positions.find(shard.local_handles[position]) = position;
+  }
+
+  shard.render_emitters.pop_back();
+  shard.emitters.pop_back();
+  shard.file_indices.pop_back();
+  shard.local_handles.pop_back();
+  shard.fingerprints.pop_back();
+  render_emitter_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::vector<TrackedRenderParticleEmitter> EmitterRegistry::render_emitters() {
+  std::vector<TrackedRenderParticleEmitter> emitters;
+  emitters.reserve(render_emitter_size());
+
+  for_each_render_emitter([&emitters] (const TrackedRenderParticleEmitter& emitter) {
+    emitters.push_back(emitter);
+  });
+
+  return emitters;
+}
+
+uint64_t EmitterRegistry::version() const {
+  return current_version.load();
+}
+
+bool EmitterRegistry::changes_since(uint64_t since, uint64_t until, std::vector<EmitterChange>& changes) {
+  size_t offset = changes.size();
+
+  if (since == 0) {
+    return false;
+  }
+
+  for (auto& shard : shards) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    if (shard->dropped_version > since) {
+      changes.resize(offset);
+      return false;
+    }
+
+    size_t capacity = shard->changes.size();
+    size_t first = shard->change_count > capacity ? shard->change_count - capacity : 0;
+
+    for (size_t i = first; i < shard->change_count; i++) {
+      const EmitterChange& change = shard->changes[i % capacity];
+
+      if (change.version > since && change.version <= until) {
+        changes.push_back(change);
+      }
+    }
+  }
+
+  std::sort(changes.begin() + offset, changes.end(), [] (const EmitterChange& left, const EmitterChange& right) {
+    return left.version < right.version;
+  });
+
+  return true;
+}
+
+uint32_t EmitterRegistry::rehash(std::chrono::steady_clock::time_point deadline, std::vector<uint8_t>& changes) {
+  uint32_t changed = 0;
+
+  for (size_t visited = 0; visited < shards.size(); visited++) {
+    Shard& shard = *shards[rehash_shard];
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    for (; rehash_position < shard.render_emitters.size(); rehash_position++) {
+      // Reading the clock for every emitter would cost about as much as hashing one
+      if (rehash_position % 16 == 0 && std::chrono::steady_clock::now() >= deadline) {
+        return changed;
+      }
+
+      uint64_t& fingerprint = shard.fingerprints[rehash_position];
+      uint64_t previous = fingerprint;
+
+      fingerprint = emitter_fingerprint(*shard.render_emitters[rehash_position]);
+
+      if (previous != 0 && previous != fingerprint) {
+        message_append(changes, global_handle(rehash_shard, shards.size(), shard.local_handles[rehash_position]));
+        message_append(changes, fingerprint);
+        changed++;
+      }
+    }
+
+    rehash_shard = (rehash_shard + 1) % shards.size();
+    rehash_position = 0;
+  }
+
+  return changed;
+}
+
+uint32_t EmitterRegistry::drain_events(std::vector<uint8_t>& events) {
+  uint32_t count = 0;
+
+  for (auto& shard : shards) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+
+    events.insert(events.end(), shard->events.begin(), shard->events.end());
+    count += shard->event_count;
+
+    shard->events.clear();
+    shard->event_count = 0;
+  }
+
+  return count;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "engine_types.h"
+#include "address_map.h"
+#include "handle_table.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TrackedRenderParticleEmitter {
+  WRenderParticleEmitter* render_emitter;
+  WParticleEmitter* emitter;
+  uint32_t file_index;
+  uint64_t handle;
+  // Of the parameters as last rehashed, 0 until the first time
+  uint64_t fingerprint;
+};
+
+struct EmitterChange {
+  uint64_t version;
+  uint64_t handle;
+  uint32_t file_index;
+  bool added;
+};
+
+// Emitters and render emitters seen by the hooks, split into shards by address. Hooks on different threads rarely wait
+// for each other, and network handlers only ever hold one shard at a time, so a handler walking all emitters blocks a
+// hook for at most one shard's worth of work. Handles carry their shard in the slot index part. Events are kept per
+// shard until drained, so their order is only kept between events of the same render emitter.
+//
+// Every change to the render emitters also gets the next version and goes into the bounded change log of its shard,
+// which lets clients catch up on what changed since a version they have seen instead of fetching the whole list.
+class EmitterRegistry {
+public:
+  // Each shard starts out with room for the given number of emitters and keeps the given number of latest changes
+  EmitterRegistry(size_t shard_count, size_t shard_capacity, size_t shard_change_log);
+
+  void track_emitter(WParticleEmitter* emitter, uint32_t file_index);
+  void untrack_emitter(WParticleEmitter* emitter);
+
+  // Returns the render emitter as tracked, with a handle of 0 if its emitter is not tracked. Registering the same
+  // render emitter again keeps its handle.
+  TrackedRenderParticleEmitter register_render_emitter(WRenderParticleEmitter* render_emitter,
+                                                       WParticleEmitter* emitter);
+  void unregister_render_emitter(WRenderParticleEmitter* render_emitter);
+
+  std::vector<TrackedRenderParticleEmitter> render_emitters();
+
+  // Number of render emitters, which may already be off by the time it is used
+  size_t render_emitter_size() const {
+    return render_emitter_count.load(std::memory_order_relaxed);
+  }
+
+  // Version of the latest change. Changes made after reading it get a higher one, so anything read from the registry
+  // afterwards includes at least the changes up to it.
+  uint64_t version() const;
+
+  // Appends the changes after since up to and including until in version order. Returns false if since is 0 or the
+  // change log of some shard no longer goes back that far, the client then needs the whole list instead.
+  bool changes_since(uint64_t since, uint64_t until, std::vector<EmitterChange>& changes);
+
+  // Rehashes the parameters of render emitters in turn until the deadline passes or all have been rehashed once, and
+  // continues where it stopped on the next call. Render emitters whose fingerprint changed since it was last taken
+  // are appended to changes as uint64_t handle and uint64_t fingerprint, the return value is how many. Removals in
+  // between may make a sweep skip or repeat some render emitters. Only called from one thread.
+  uint32_t rehash(std::chrono::steady_clock::time_point deadline, std::vector<uint8_t>& changes);
+
+  // Appends the events of all shards since the last call and returns how many there were. Each event is uint8_t
+  // created, uint64_t handle and uint32_t file index.
+  uint32_t drain_events(std::vector<uint8_t>& events);
+
+  // Calls function(emitter) with the shard of the render emitter locked, so that it is not destroyed meanwhile
+  template <class Function>
+  bool with_render_emitter(uint64_t handle, Function function) {
+    auto index = (uint32_t) handle;
+    size_t shard_index = index % shards.size();
+    Shard& shard = *shards[shard_index];
+    uint64_t local_handle = (handle & 0xFFFFFFFF00000000ull) | (index / shards.size());
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    const uint32_t* position = shard.render_emitter_positions.find(local_handle);
+
+    if (position == nullptr) {
+      return false;
+    }
+
+    function(render_emitter_at(shard, shard_index, shards.size(), *position));
+    return true;
+  }
+
+  // Calls function(emitter) for every render emitter, one shard locked at a time
+  template <class Function>
+  void for_each_render_emitter(Function function) {
+    for (size_t i = 0; i < shards.size(); i++) {
+      const Shard& shard = *shards[i];
+      std::lock_guard<std::mutex> guard(shards[i]->lock);
+
+      for (uint32_t position = 0; position < shard.render_emitters.size(); position++) {
+        function(render_emitter_at(shard, i, shards.size(), position));
+      }
+    }
+  }
+
+private:
+  // Render emitters are kept densely as structure of arrays, so that walking them is a linear scan. Handles point at
+  // their position through the handle table, removing one moves the last into its place. Nothing allocates once the
+  // arrays and maps have grown to the size of the scene.
+  struct alignas(64) Shard {
+    std::mutex lock;
+    AddressMap<WParticleEmitter*, uint32_t> emitter_files;
+    AddressMap<WRenderParticleEmitter*, uint64_t> render_emitter_handles;
+    HandleTable<uint32_t> render_emitter_positions;
+
+    std::vector<WRenderParticleEmitter*> render_emitters;
+    std::vector<WParticleEmitter*> emitters;
+    std::vector<uint32_t> file_indices;
+    std::vector<uint64_t> local_handles;
+    std::vector<uint64_t> fingerprints;
+
+    std::vector<uint8_t> events;
+    uint32_t event_count = 0;
+
+    // Ring of the latest changes, changes up to dropped_version have been overwritten
+    std::vector<EmitterChange> changes;
+    size_t change_count = 0;
+    uint64_t dropped_version = 0;
+
+    Shard(size_t capacity, size_t change_log);
+  };
+
+  static uint64_t global_handle(size_t shard, size_t shard_count, uint64_t local_handle) {
+    auto index = (uint64_t) (uint32_t) local_handle * shard_count + shard;
+    return (local_handle & 0xFFFFFFFF00000000ull) | (uint32_t) index;
+  }
+
+  static TrackedRenderParticleEmitter render_emitter_at(const Shard& shard, size_t shard_index, size_t shard_count,
+                                                        uint32_t position) {
+    return {
+        shard.render_emitters[position],
+        shard.emitters[position],
+        shard.file_indices[position],
+        global_handle(shard_index, shard_count, shard.local_handles[position]),
+        shard.fingerprints[position]
+    };
+  }
+
+  size_t shard_index(const void* address) const;
+  void record_change(Shard& shard, bool added, uint32_t position, uint64_t handle);
+
+  std::vector<std::unique_ptr<Shard>> shards;
+  // Only a hint for sizing snapshots
+  std::atomic<size_t> render_emitter_count { 0 };
+  std::atomic<uint64_t> current_version { 0 };
+
+  size_t rehash_shard = 0;
+  size_t rehash_position = 0;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "emitter_encoding.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// All emitters with one column per field of emitter_fields, built in one pass and laid out so that the file can be
+// mapped and used in place. Everything is little endian and each part starts at a multiple of 8 bytes from the start.
+//
+// Header: uint32_t magic "WEMS", uint32_t format, uint64_t registry version, uint32_t emitter count N, uint32_t column
+// count, uint64_t offset of the handle column, which is N uint64_t handles.
+// Column table, one entry per field in schema order: uint8_t kind, 3 reserved bytes, uint32_t item size, uint32_t name
+// offset, uint32_t name length, uint64_t data offset, uint64_t index offset.
+// Column names follow the table without terminators. A fixed column is N values. A list column has an index of N + 1
+// uint32_t item offsets, so emitter i has the items from index[i] to index[i + 1] in its data, and has no item cap.
+class EmitterSnapshot {
+public:
+  static constexpr uint32_t magic = 0x534D4557;
+  static constexpr uint32_t format = 1;
+  static constexpr size_t header_size = 32;
+  static constexpr size_t column_entry_size = 32;
+  static constexpr size_t column_count = sizeof(emitter_fields) / sizeof(emitter_fields[0]);
+
+  // Fixed columns and list indices are reserved for the expected number of emitters
+  EmitterSnapshot(uint64_t version, size_t expected_emitters) : version(version) {
+    uint32_t first = 0;
+    handles.reserve(expected_emitters * sizeof(uint64_t));
+
+    for (size_t i = 0; i < column_count; i++) {
+      if (emitter_field_is_list(emitter_fields[i].kind)) {
+        columns[i].index.reserve((expected_emitters + 1) * sizeof(uint32_t));
+        message_append(columns[i].index, first);
+      } else {
+        columns[i].data.reserve(expected_emitters * emitter_field_size(emitter_fields[i].kind));
+      }
+    }
+  }
+
+  void add(uint64_t handle, const WRenderParticleEmitter& emitter) {
+    auto base = reinterpret_cast<const uint8_t*>(&emitter);
+    message_append(handles, handle);
+
+    for (size_t i = 0; i < column_count; i++) {
+      const EmitterField& field = emitter_fields[i];
+      Column& column = columns[i];
+      uint32_t size = emitter_field_size(field.kind);
+
+      if (!emitter_field_is_list(field.kind)) {
+        message_append(column.data, base + field.offset, size);
+        continue;
+      }
+
+      const auto& buffer = *reinterpret_cast<const WXBuffer<uint8_t>*>(base + field.offset);
+
+      message_append(column.data, buffer.data, (size_t) buffer.length * size);
+      column.items += buffer.length;
+      message_append(column.index, column.items);
+    }
+
+    count++;
+  }
+
+  // Passes the snapshot to sink(const std::vector<uint8_t>&) in parts, stops and returns false if the sink does. Pads
+  // the columns, so it is only called once.
+  template <class Sink>
+  bool write(Sink sink) {
+    std::vector<uint8_t> head;
+    std::vector<uint8_t> names;
+    std::vector<uint8_t> table;
+
+    for (const EmitterField& field : emitter_fields) {
+      message_append(names, field.name, std::strlen(field.name));
+    }
+
+    pad(names);
+
+    uint64_t names_offset = header_size + column_count * column_entry_size;
+    uint64_t handles_offset = names_offset + names.size();
+    uint64_t offset = handles_offset + handles.size();
+    uint32_t name_offset = (uint32_t) names_offset;
+
+    for (size_t i = 0; i < column_count; i++) {
+      const EmitterField& field = emitter_fields[i];
+      Column& column = columns[i];
+      uint8_t reserved[3] = {};
+      uint32_t item_size = emitter_field_size(field.kind);
+      auto name_length = (uint32_t) std::strlen(field.name);
+      uint64_t index_offset = 0;
+
+      if (emitter_field_is_list(field.kind)) {
+        pad(column.index);
+        index_offset = offset;
+        offset += column.index.size();
+      }
+
+      pad(column.data);
+
+      message_append(table, field.kind);
+      message_append(table, reserved, sizeof(reserved));
+      message_append(table, item_size);
+      message_append(table, name_offset);
+      message_append(table, name_length);
+      message_append(table, offset);
+      message_append(table, index_offset);
+
+      name_offset += name_length;
+      offset += column.data.size();
+    }
+
+    auto column_total = (uint32_t) column_count;
+
+    message_append(head, magic);
+    message_append(head, format);
+    message_append(head, version);
+    message_append(head, count);
+    message_append(head, column_total);
+    message_append(head, handles_offset);
+    head.insert(head.end(), table.begin(), table.end());
+    head.insert(head.end(), names.begin(), names.end());
+
+    if (!sink(head) || !write_part(sink, handles)) {
+      return false;
+    }
+
+    for (const Column& column : columns) {
+      if (!write_part(sink, column.index) || !write_part(sink, column.data)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+  struct Column {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> index;
+    uint32_t items = 0;
+  };
+
+  static void pad(std::vector<uint8_t>& part) {
+    part.resize((part.size() + 7) & ~(size_t) 7);
+  }
+
+  template <class Sink>
+  static bool write_part(Sink& sink, const std::vector<uint8_t>& part) {
+    return part.empty() || sink(part);
+  }
+
+  uint64_t version;
+  uint32_t count = 0;
+  std::vector<uint8_t> handles;
+  Column columns[column_count];
+};
@@ -3,19 +3,49 @@
 #include "engine_types.h"
 #include "logging/log.h"
 #include "server/message_builder.h"
+#include "emitter_encoding.h"
+#include "emitter_snapshot.h"
 #include "bundles.h"
+#include "emitter_registry.h"
+#include "emitter_override.h"
+#include "emitter_edit.h"
 #include <fstream>
+#include <mutex>
 
 static void* vtable_WParticleEmitter = nullptr;
 static void* vtable_WDependencyLoader = nullptr;
+static TcpServer* server = nullptr;
 
-struct TrackedParticleEmitter {
-  WParticleEmitter* emitter;
-  uint32_t file_index;
+// Hooks run on engine threads, so the registry is sharded to keep them from waiting on each other or on handlers
+static EmitterRegistry registry(16, 1024, 1024);
+
+enum EmitterOverrideFilter : uint8_t {
+  emitter_override_all,
+  emitter_override_file,
+  emitter_override_bundle
+};
+
+struct EmitterOverrideRequest {
+  // Empty to apply the config which is already loaded
+  std::vector<uint8_t> config;
+  EmitterOverrideFilter filter;
+  uint32_t value;
 };
 
-static std::mutex emitter_lock;
-static std::unordered_map<WParticleEmitter*, TrackedParticleEmitter> tracked_emitters;
+// Requests come from handler threads, but only the game thread parses and applies them
+static std::mutex override_request_lock;
+static std::unique_ptr<EmitterOverrideRequest> override_request;
+static std::unique_ptr<EmitterOverride> emitter_override;
+static std::vector<uint64_t> override_targets;
+static size_t override_position = 0;
+static uint32_t override_copied = 0;
+static uint32_t override_parsed = 0;
+
+// Lists replaced by edits, which have to be put back before the engine frees the emitter
+static EmitterArenas emitter_arenas;
+static std::mutex edit_lock;
+static std::vector<EmitterEdit> pending_edits;
+static std::vector<EmitterEdit> applied_edits;
 
 static void hook_emitter_parse_data(WParticleEmitter* emitter, WDependencyLoader* loader) {
   if (emitter->vtable_one != vtable_WParticleEmitter || loader->vtable_one != vtable_WDependencyLoader) {
@@ -23,57 +53,32 @@ static void hook_emitter_parse_data(WParticleEmitter* emitter, WDependencyLoader
     return;
   }
 
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
-    tracked_emitters[emitter] = { emitter, loader->file->file_index };
-  }
+  registry.track_emitter(emitter, loader->file->file_index);
 
   logger::it->debug("Parsed CParticleEmitter ({:x}) data from file {}", logger::ptr(emitter), loader->file->file_index);
 }
 
 static void hook_emitter_destruct(WParticleEmitter* emitter) {
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
-    tracked_emitters.erase(emitter);
-  }
+  registry.untrack_emitter(emitter);
 
   logger::it->debug("Destroyed CParticleEmitter ({:x})", logger::ptr(emitter));
 }
 
-struct TrackedRenderParticleEmitter {
-  WRenderParticleEmitter* render_emitter;
-  WParticleEmitter* emitter;
-  uint32_t file_index;
-};
-
-static std::unordered_map<WRenderParticleEmitter*, TrackedRenderParticleEmitter> tracked_render_emitters;
-
 static void hook_render_emitter_register(WRenderParticleEmitter* render_emitter, WParticleEmitter* emitter) {
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
+  TrackedRenderParticleEmitter tracked = registry.register_render_emitter(render_emitter, emitter);
 
-    const auto& it = tracked_emitters.find(emitter);
-
-    if (it != tracked_emitters.end()) {
-      tracked_render_emitters[render_emitter] = {
-          render_emitter,
-          it->second.emitter,
-          it->second.file_index
-      };
-
-      logger::it->debug("Setup CRenderParticleEmitter {:x} from {:x} file {}", logger::ptr(render_emitter),
-                        logger::ptr(it->second.emitter), it->second.file_index);
-    } else {
-      logger::it->debug("Setup CRenderParticleEmitter {:x}, but no corresponding emitter", logger::ptr(render_emitter));
-    }
+  if (tracked.handle != 0) {
+    logger::it->debug("Setup CRenderParticleEmitter {:x} from {:x} file {}", logger::ptr(render_emitter),
+                      logger::ptr(emitter), tracked.file_index);
+  } else {
+    logger::it->debug("Setup CRenderParticleEmitter {:x}, but no corresponding emitter", logger::ptr(render_emitter));
   }
 }
 
 static void hook_render_emitter_destruct(WRenderParticleEmitter* render_emitter) {
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
-    tracked_render_emitters.erase(render_emitter);
-  }
+  registry.unregister_render_emitter(render_emitter);
+  // No edit can reach the emitter anymore once it is out of the registry
+  emitter_arenas.release(render_emitter);
 
   logger::it->debug("Destroyed CRenderParticleEmitter {:x}", logger::ptr(render_emitter));
 }
@@ -186,225 +191,301 @@ static void hook_set_render_emitter_destruct(ExecutableAddressSpace &space, Wrap
   hook.u64((uint64_t) wrapper.address);
 }
 
-static void message_emitter_list(uint16_t type, const std::vector<uint8_t> &message, const TcpMessageSender &sender) {
-  std::vector<uint8_t> response;
+// Handle, directory, file name and bundle path
+static void append_emitter_entry(std::vector<uint8_t>& chunk, uint64_t handle, uint32_t file_index) {
+  message_append(chunk, handle);
 
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
+  WBundleDiskFile* file = bundle_file_find(file_index);
 
-    uint32_t size = tracked_render_emitters.size();
-    message_append(response, size);
+  if (file != nullptr) {
+    std::wstring directory;
+    bundle_format_file_directory(file->directory, directory);
 
-    for (const auto& it : tracked_render_emitters) {
-      auto address = (uint64_t) it.second.render_emitter;
-      std::string name = fmt::format("{:016x}h", address);
+    message_append_string(chunk, directory);
+    message_append_string(chunk, file->file_name.text);
+  } else {
+    message_append_string(chunk, "<unknown>");
+    message_append_string(chunk, "<unknown>");
+  }
 
-      message_append_string(response, name);
+  WDiskBundle* bundle = bundle_file_identify(file_index);
+
+  if (bundle != nullptr) {
+    message_append_string(chunk, bundle->absolute_path.text);
+  } else {
+    message_append_string(chunk, "<unknown>");
+  }
+}
 
-      WBundleDiskFile* file = bundle_file_find(it.second.file_index);
+// Passes on full chunks, returns false if the client went away
+static bool flush_emitter_chunk(std::vector<uint8_t>& chunk, TcpMessageStream& stream) {
+  if (chunk.size() < 0x10000) {
+    return true;
+  } else if (!stream.append(chunk)) {
+    return false;
+  }
 
-      if (file != nullptr) {
-        std::wstring directory;
-        bundle_format_file_directory(file->directory, directory);
+  chunk.clear();
+  return true;
+}
 
-        message_append_string(response, directory);
-        message_append_string(response, std::wstring(file->file_name.text));
-      } else {
-        message_append_string(response, "<unknown>");
-        message_append_string(response, "<unknown>");
-      }
+static void stream_emitter_list(std::vector<uint8_t>& chunk, const std::vector<TrackedRenderParticleEmitter>& emitters,
+                                TcpMessageStream& stream) {
+  uint32_t size = emitters.size();
+  message_append(chunk, size);
 
-      WDiskBundle* bundle = bundle_file_identify(it.second.file_index);
+  for (const auto& emitter : emitters) {
+    append_emitter_entry(chunk, emitter.handle, emitter.file_index);
 
-      if (bundle != nullptr) {
-        message_append_string(response, std::wstring(bundle->absolute_path.text));
-      } else {
-        message_append_string(response, "<unknown>");
-      }
+    if (!flush_emitter_chunk(chunk, stream)) {
+      return;
     }
   }
 
-  sender(6, response);
+  if (stream.append(chunk)) {
+    stream.end();
+  }
+}
+
+static void message_emitter_list(uint16_t type, const std::vector<uint8_t> &message, TcpMessageStream &stream) {
+  // Strings are resolved without holding the registry, so that a slow client does not hold up the hooks
+  std::vector<TrackedRenderParticleEmitter> emitters = registry.render_emitters();
+
+  if (!stream.begin(6)) {
+    return;
+  }
+
+  std::vector<uint8_t> chunk;
+  stream_emitter_list(chunk, emitters, stream);
 }
 
-template <typename T>
-static void encode_buffer(std::vector<uint8_t>& response, const WXBuffer<T>& buffer,
-                          std::function<void(std::vector<uint8_t>&, const T&)> item_encoder) {
+// Message 28 takes the last version the client has seen and answers with type 29: uint64_t current version, uint8_t
+// full, then uint32_t count. A full answer lists the emitters like type 6, otherwise each change is uint8_t added and
+// the entry for an added emitter or just the handle for a removed one. Changes are in order, but the same emitter may
+// show up in both a full list and the changes after it, so they are best applied as set operations.
+static void message_emitter_changes(uint16_t type, const std::vector<uint8_t> &message, TcpMessageStream &stream) {
+  if (message.size() != sizeof(uint64_t)) {
+    if (stream.begin(2)) {
+      stream.end();
+    }
 
-  if (buffer.length >= 64) {
-    throw std::exception("Cannot encode buffer, too many items");
+    return;
   }
 
-  uint8_t length = (uint8_t) buffer.length;
-  message_append(response, length);
+  uint64_t since = *(uint64_t*) &message[0];
+  uint64_t version = registry.version();
 
-  for (size_t i = 0; i < buffer.length; i++) {
-    item_encoder(response, buffer.data[i]);
+  std::vector<EmitterChange> changes;
+  std::vector<TrackedRenderParticleEmitter> emitters;
+  uint8_t full = registry.changes_since(since, version, changes) ? 0 : 1;
+
+  if (full) {
+    emitters = registry.render_emitters();
   }
-}
 
-static void encode_float(std::vector<uint8_t>& response, const float& value) {
-  message_append(response, value);
-}
+  if (!stream.begin(29)) {
+    return;
+  }
+
+  std::vector<uint8_t> chunk;
+  message_append(chunk, version);
+  message_append(chunk, full);
 
-static void encode_buffer(std::vector<uint8_t>& response, const WXBuffer<float>& buffer) {
-  encode_buffer<float>(response, buffer, encode_float);
+  if (full) {
+    stream_emitter_list(chunk, emitters, stream);
+    return;
+  }
+
+  uint32_t size = changes.size();
+  message_append(chunk, size);
+
+  for (const auto& change : changes) {
+    uint8_t added = change.added ? 1 : 0;
+    message_append(chunk, added);
+
+    if (change.added) {
+      append_emitter_entry(chunk, change.handle, change.file_index);
+    } else {
+      message_append(chunk, change.handle);
+    }
+
+    if (!flush_emitter_chunk(chunk, stream)) {
+      return;
+    }
+  }
+
+  if (stream.append(chunk)) {
+    stream.end();
+  }
 }
 
-static void encode_vector3(std::vector<uint8_t>& response, const WXVector3& value) {
-  message_append(response, value.x);
-  message_append(response, value.y);
-  message_append(response, value.z);
+static void message_emitter_details(uint16_t type, const std::vector<uint8_t> &message, const TcpMessageSender &sender) {
+  std::vector<uint8_t> response;
+
+  if (message.size() != sizeof(uint64_t)) {
+    sender(2, response);
+    return;
+  }
+
+  uint64_t handle = *(uint64_t*) &message[0];
+
+  registry.with_render_emitter(handle, [&response] (const TrackedRenderParticleEmitter& emitter) {
+    response.push_back(1);
+    message_append_fields(response, *emitter.render_emitter);
+  });
+
+  if (response.empty()) {
+    response.push_back(0);
+  }
+
+  sender(8, response);
 }
 
-static void encode_buffer(std::vector<uint8_t>& response, const WXBuffer<WXVector3>& buffer) {
-  encode_buffer<WXVector3>(response, buffer, encode_vector3);
+// Message 30 answers with type 31, a columnar snapshot of every emitter as laid out in emitter_snapshot.h. Each shard
+// is held while its emitters are copied, so none of them is destroyed halfway through.
+static void message_emitter_snapshot(uint16_t type, const std::vector<uint8_t> &message, TcpMessageStream &stream) {
+  EmitterSnapshot snapshot(registry.version(), registry.render_emitter_size());
+
+  registry.for_each_render_emitter([&snapshot] (const TrackedRenderParticleEmitter& emitter) {
+    snapshot.add(emitter.handle, *emitter.render_emitter);
+  });
+
+  if (!stream.begin(31)) {
+    return;
+  }
+
+  // Columns of large scenes go out in chunks of the same size as the emitter list
+  std::vector<uint8_t> chunk;
+
+  bool written = snapshot.write([&stream, &chunk] (const std::vector<uint8_t>& part) {
+    for (size_t offset = 0; offset < part.size(); offset += 0x10000) {
+      chunk.assign(part.begin() + offset, part.begin() + std::min(part.size(), offset + 0x10000));
+
+      if (!stream.append(chunk)) {
+        return false;
+      }
+    }
+
+    return true;
+  });
+
+  if (written) {
+    stream.end();
+  }
 }
 
-static void encode_vector2(std::vector<uint8_t>& response, const WXVector2& value) {
-  message_append(response, value.x);
-  message_append(response, value.y);
+// Message 32 answers with type 33: uint32_t count, then uint64_t handle and uint64_t fingerprint of every emitter.
+// Emitters with equal fingerprints have the same parameters, 0 means the emitter has not been hashed yet.
+static void message_emitter_fingerprints(uint16_t type, const std::vector<uint8_t> &message,
+                                         const TcpMessageSender &sender) {
+  std::vector<uint8_t> response(sizeof(uint32_t));
+  uint32_t count = 0;
+
+  response.reserve(sizeof(uint32_t) + registry.render_emitter_size() * 2 * sizeof(uint64_t));
+
+  registry.for_each_render_emitter([&response, &count] (const TrackedRenderParticleEmitter& emitter) {
+    message_append(response, emitter.handle);
+    message_append(response, emitter.fingerprint);
+    count++;
+  });
+
+  std::memcpy(response.data(), &count, sizeof(count));
+  sender(33, response);
 }
 
-static void encode_buffer(std::vector<uint8_t>& response, const WXBuffer<WXVector2>& buffer) {
-  encode_buffer<WXVector2>(response, buffer, encode_vector2);
+static void message_emitter_schema(uint16_t type, const std::vector<uint8_t> &message, const TcpMessageSender &sender) {
+  sender(27, emitter_schema_message());
 }
 
-static void encode_emitter_data(std::vector<uint8_t>& response, const TrackedRenderParticleEmitter& tracked_emitter) {
-  WRenderParticleEmitter& emitter = *tracked_emitter.render_emitter;
-
-  message_append(response, emitter.initializer_bitset);
-  message_append(response, emitter.modificator_bitset);
-
-  WXParticleEmitterModuleData& data = emitter.emitter_data;
-  encode_buffer(response, data.alpha);
-  encode_buffer(response, data.color);
-  encode_buffer(response, data.lifetime);
-  encode_buffer(response, data.position);
-  encode_float(response, data.position_offset);
-  encode_buffer(response, data.rotation);
-  encode_buffer(response, data.rotation_3d);
-  encode_buffer(response, data.rotation_rate);
-  encode_buffer(response, data.rotation_rate_3d);
-  encode_buffer(response, data.size);
-  encode_buffer(response, data.size_3d);
-  message_append(response, data.size_keep_ratio);
-  encode_buffer(response, data.spawn_extents);
-  encode_buffer(response, data.spawn_inner_radius);
-  encode_buffer(response, data.spawn_outer_radius);
-  message_append(response, data.spawn_world_space);
-  message_append(response, data.spawn_surface_only);
-  encode_vector3(response, data.p0A8);
-
-  for (float i : data.spawn_to_local_matrix) {
-    encode_float(response, i);
-  }
-
-  encode_buffer(response, data.velocity);
-  message_append(response, data.velocity_world_space);
-  encode_buffer(response, data.velocity_inherit_scale);
-  encode_buffer(response, data.velocity_spread_scale);
-  message_append(response, data.velocity_spread_conserve_momentum);
-  encode_buffer(response, data.texture_animation_initial_frame);
-  message_append(response, data.p140);
-  message_append(response, data.p144);
-  message_append(response, data.p148);
-
-  encode_buffer(response, data.velocity_over_life);
-  encode_buffer(response, data.acceleration_direction);
-  encode_buffer(response, data.acceleration_scale);
-  encode_buffer(response, data.rotation_over_life);
-  encode_buffer(response, data.rotation_rate_over_life);
-  encode_buffer(response, data.rotation_3d_over_life);
-  encode_buffer(response, data.rotation_rate_3d_over_life);
-  encode_buffer(response, data.color_over_life);
-  encode_buffer(response, data.alpha_over_life);
-  encode_buffer(response, data.size_over_life);
-  encode_buffer(response, data.size_over_life_orientation);
-  encode_buffer(response, data.texture_animation_speed);
-  encode_buffer(response, data.velocity_turbulize_scale);
-  encode_buffer(response, data.velocity_turbulize_timelife_limit);
-  encode_float(response, data.velocity_turbulize_noise_interval);
-  encode_float(response, data.velocity_turbulize_duration);
-  encode_buffer(response, data.target_force_scale);
-  encode_buffer(response, data.target_kill_radius);
-  encode_float(response, data.target_max_force);
-  encode_buffer(response, data.target_position);
-  message_append(response, data.spawn_positive_x);
-  message_append(response, data.spawn_negative_x);
-  message_append(response, data.spawn_positive_y);
-  message_append(response, data.spawn_negative_y);
-  message_append(response, data.spawn_position_z);
-  message_append(response, data.spawn_negative_z);
-  message_append(response, data.spawn_velocity);
-  message_append(response, data.collision_triggering_group_index);
-  encode_float(response, data.collision_dynamic_friction);
-  encode_float(response, data.collision_static_friction);
-  encode_float(response, data.collision_restitution);
-  encode_float(response, data.collision_velocity_dampening);
-  message_append(response, data.collision_disable_gravity);
-  message_append(response, data.collision_use_gpu);
-  encode_float(response, data.collision_radius);
-  message_append(response, data.collision_kill_when_collide);
-  message_append(response, data.collision_self_emitter_index);
-  encode_float(response, data.collision_spawn_probability);
-  message_append(response, data.collision_spawn_parent_emitter_index);
-  encode_float(response, data.alpha_by_distance_far);
-  encode_float(response, data.alpha_by_distance_near);
+// Reloading reads emitter.bin from disk on the calling thread, returns false if that fails
+static bool queue_emitter_override(bool reload, EmitterOverrideFilter filter, uint32_t value) {
+  auto request = std::make_unique<EmitterOverrideRequest>();
+  request->filter = filter;
+  request->value = value;
+
+  if (reload) {
+    std::ifstream file(R"(C:\Projects\witch\fileoverride\logx\emitter.bin)", std::ios::binary);
+    request->config.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (request->config.empty()) {
+      return false;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(override_request_lock);
+  override_request = std::move(request);
+  return true;
 }
 
-static void message_emitter_details(uint16_t type, const std::vector<uint8_t> &message, const TcpMessageSender &sender) {
+// Message 36: uint8_t reload, uint8_t filter and uint32_t value, answered with type 37 and the same body once queued.
+// Reload reads emitter.bin again, otherwise the last loaded config is applied. The filter picks all emitters, those from
+// the file index or those from the bundle index given by value. Progress is reported with message type 38.
+static void message_emitter_override(uint16_t type, const std::vector<uint8_t> &message,
+                                     const TcpMessageSender &sender) {
   std::vector<uint8_t> response;
 
-  if (message.size() < 4) {
+  if (message.size() != 2 + sizeof(uint32_t) || message[1] > emitter_override_bundle) {
     sender(2, response);
     return;
   }
 
-  size_t name_length = *(uint32_t*) &message[0];
+  uint32_t value;
+  std::memcpy(&value, &message[2], sizeof(value));
 
-  if (message.size() != 4 + name_length) {
+  // Reading the file here keeps the disk off the game thread
+  if (!queue_emitter_override(message[0] != 0, (EmitterOverrideFilter) message[1], value)) {
     sender(2, response);
     return;
   }
 
-  std::string requested_name((char*) &message[4], name_length);
+  sender(37, message);
+}
 
-  {
-    std::lock_guard<std::mutex> guard(emitter_lock);
-
-    for (const auto& it : tracked_render_emitters) {
-      auto address = (uint64_t) it.second.render_emitter;
-      std::string name = fmt::format("{:016x}h", address);
-
-      if (name == requested_name) {
-        response.push_back(1);
-
-        try {
-          encode_emitter_data(response, it.second);
-          break;
-        } catch (const std::exception& error) {
-          response.clear();
-          sender(2, response);
-          return;
-        }
-      }
-    }
+// Message 40 queues an edit as laid out in emitter_edit.h for the next frame and answers with type 41: uint8_t 1 if
+// queued, 0 if there is no emitter with the handle. Message type 42 tells when it has been applied.
+static void message_emitter_edit(uint16_t type, const std::vector<uint8_t> &message, const TcpMessageSender &sender) {
+  EmitterEdit edit;
+  std::vector<uint8_t> response;
+
+  if (!emitter_edit_decode(message, edit)) {
+    sender(2, response);
+    return;
   }
 
-  if (response.empty()) {
+  if (!registry.with_render_emitter(edit.handle, [] (const TrackedRenderParticleEmitter& emitter) { })) {
     response.push_back(0);
+    sender(41, response);
+    return;
   }
 
-  sender(8, response);
+  {
+    std::lock_guard<std::mutex> guard(edit_lock);
+    pending_edits.push_back(std::move(edit));
+  }
+
+  response.push_back(1);
+  sender(41, response);
 }
 
 void emitters_setup(TcpServer* tcp_server, WrapperAddressSpace* wrapper_space) {
   ExecutableAddressSpace space;
 
+  server = tcp_server;
   vtable_WParticleEmitter = (void*) space.by_offset(0x1F3F478);
   vtable_WDependencyLoader = (void*) space.by_offset(0x1DDAD78);
 
+  WMemoryFileReader reader {
+      (void*) space.by_offset(0x1CFC3E8),
+      0x100052,
+      0xA3,
+      (void*) space.by_offset(0x1CFC4C0),
+      nullptr,
+      0,
+      0
+  };
+
+  emitter_override = std::make_unique<EmitterOverride>((emitter_config_parser_fn) space.by_offset(0x518AE0), reader);
+
   // Registers a WParticleEmitter after it has
   hook_set_emitter_register(space, wrapper_space);
   // Removes dead WParticleEmitters from tracking
@@ -414,44 +495,168 @@ void emitters_setup(TcpServer* tcp_server, WrapperAddressSpace* wrapper_space) {
   // Removes dead WRenderParticleEmitter from tracking
   hook_set_render_emitter_destruct(space, wrapper_space);
 
-  tcp_server->add_handler(5, message_emitter_list);
+  tcp_server->add_stream_handler(5, message_emitter_list);
   tcp_server->add_handler(7, message_emitter_details);
+  tcp_server->add_handler(26, message_emitter_schema);
+  tcp_server->add_stream_handler(28, message_emitter_changes);
+  tcp_server->add_stream_handler(30, message_emitter_snapshot);
+  tcp_server->add_handler(32, message_emitter_fingerprints);
+  tcp_server->add_handler(36, message_emitter_override);
+  tcp_server->add_handler(40, message_emitter_edit);
 }
 
-typedef void (*emitter_config_parser_fn)(WMemoryFileReader* reader, WXParticleEmitterModuleData* something);
+static bool override_matches(const EmitterOverrideRequest& request, uint32_t file_index) {
+  if (request.filter == emitter_override_file) {
+    return file_index == request.value;
+  } else if (request.filter == emitter_override_bundle) {
+    WDiskBundle* bundle = bundle_file_identify(file_index);
+    return bundle != nullptr && bundle->index == request.value;
+  }
 
-static void overwrite_all_emitters() {
-  std::vector<char> config;
+  return true;
+}
+
+// Starts a pass over the emitters the latest request selects, loading its config first if it has one
+static void start_emitter_override() {
+  std::unique_ptr<EmitterOverrideRequest> request;
 
   {
-    std::ifstream file(R"(C:\Projects\witch\fileoverride\logx\emitter.bin)", std::ios::binary);
-    config.insert(config.begin(), std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    std::lock_guard<std::mutex> guard(override_request_lock);
+    request = std::move(override_request);
   }
 
-  ExecutableAddressSpace space;
-  auto parser = (emitter_config_parser_fn) space.by_offset(0x518AE0);
+  if (request == nullptr) {
+    return;
+  }
 
-  WMemoryFileReader reader {
-      (void*) space.by_offset(0x1CFC3E8),
-      0x100052,
-      0xA3,
-      (void*) space.by_offset(0x1CFC4C0),
-      (uint8_t*) config.data(),
-      config.size(),
-      0
-  };
+  if (!request->config.empty()) {
+    emitter_override->load(std::move(request->config));
+  }
+
+  if (!emitter_override->loaded()) {
+    logger::it->warn("Emitter override requested before any config was loaded");
+    return;
+  }
+
+  // A newer request replaces what is left of the previous pass
+  override_targets.clear();
+  override_position = 0;
+  override_copied = 0;
+  override_parsed = 0;
+
+  registry.for_each_render_emitter([&request] (const TrackedRenderParticleEmitter& emitter) {
+    if (override_matches(*request, emitter.file_index)) {
+      override_targets.push_back(emitter.handle);
+    }
+  });
+
+  logger::it->info("Overriding {} emitters", override_targets.size());
+}
+
+// Subscribers of message type 38 get uint32_t emitters copied and uint32_t emitters parsed again once a pass is done.
+// Each frame applies the override to as many emitters as fit in the budget, emitters destroyed before their turn are
+// left out.
+static void apply_emitter_override() {
+  start_emitter_override();
+
+  if (override_position == override_targets.size()) {
+    return;
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(500);
 
-  std::lock_guard<std::mutex> guard(emitter_lock);
+  for (; override_position < override_targets.size(); override_position++) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return;
+    }
+
+    uint64_t handle = override_targets[override_position];
 
-  for (const auto& it : tracked_render_emitters) {
-    reader.position = 0;
-    parser(&reader, &it.second.render_emitter->emitter_data);
+    registry.with_render_emitter(handle, [] (const TrackedRenderParticleEmitter& emitter) {
+      // The engine may free lists when parsing, and the override sets all of them anyway
+      emitter_arenas.release(emitter.render_emitter);
+      (emitter_override->apply(emitter.render_emitter->emitter_data) ? override_copied : override_parsed)++;
+    });
   }
+
+  override_targets.clear();
+  override_position = 0;
+
+  auto message = std::make_shared<std::vector<uint8_t>>();
+  message_append(*message, override_copied);
+  message_append(*message, override_parsed);
+
+  server->publish(38, std::move(message));
+}
+
+// Subscribers of message type 42 get the edits applied this frame: uint32_t count, then uint64_t handle and uint8_t
+// applied of each, which is 0 if the emitter was destroyed before the frame. Each edit is applied whole between frames.
+static void apply_emitter_edits() {
+  {
+    std::lock_guard<std::mutex> guard(edit_lock);
+    applied_edits.swap(pending_edits);
+  }
+
+  if (applied_edits.empty()) {
+    return;
+  }
+
+  auto message = std::make_shared<std::vector<uint8_t>>();
+  auto count = (uint32_t) applied_edits.size();
+  message_append(*message, count);
+
+  for (const EmitterEdit& edit : applied_edits) {
+    bool found = registry.with_render_emitter(edit.handle, [&edit] (const TrackedRenderParticleEmitter& emitter) {
+      emitter_edit_apply(edit, *emitter.render_emitter, emitter_arenas);
+    });
+
+    uint8_t applied = found ? 1 : 0;
+    message_append(*message, edit.handle);
+    message_append(*message, applied);
+  }
+
+  applied_edits.clear();
+  server->publish(42, std::move(message));
+}
+
+// Subscribers of message type 18 get the events of each frame as one message: uint32_t count, then the events
+static void publish_render_emitter_events() {
+  auto message = std::make_shared<std::vector<uint8_t>>(sizeof(uint32_t));
+  uint32_t count = registry.drain_events(*message);
+
+  if (count == 0) {
+    return;
+  }
+
+  std::memcpy(message->data(), &count, sizeof(count));
+
+  server->publish(18, std::move(message));
+}
+
+// Subscribers of message type 34 get the emitters whose parameters changed: uint32_t count, then uint64_t handle and
+// uint64_t fingerprint of each. Every frame rehashes as many emitters as fit in the budget, so large scenes take a few
+// frames to notice a change instead of slowing down each one.
+static void publish_fingerprint_changes() {
+  auto message = std::make_shared<std::vector<uint8_t>>(sizeof(uint32_t));
+  uint32_t count = registry.rehash(std::chrono::steady_clock::now() + std::chrono::microseconds(500), *message);
+
+  if (count == 0) {
+    return;
+  }
+
+  std::memcpy(message->data(), &count, sizeof(count));
+
+  server->publish(34, std::move(message));
 }
 
 static bool last_state = false;
 
 void emitters_loop() {
+  publish_render_emitter_events();
+  apply_emitter_override();
+  apply_emitter_edits();
+  publish_fingerprint_changes();
+
   /*
   bool current_state = (GetKeyState(VK_INSERT) & 0x8000) != 0;
 
@@ -459,7 +664,7 @@ void emitters_loop() {
     last_state = current_state;
 
     if (current_state) {
-      overwrite_all_emitters();
+      queue_emitter_override(true, emitter_override_all, 0);
     }
   }
    */
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Fast 64-bit content hash for noticing changes and finding identical data, not meant to withstand crafted input.
+// Takes 8 bytes per step with a multiply and rotate per word and a final avalanche, never gives 0 so that 0 can stand
+// for not hashed yet.
+class Fingerprint {
+public:
+  void update(const void* data, size_t length) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    total += length;
+
+    for (; length >= 8; bytes += 8, length -= 8) {
+      uint64_t word;
+      std::memcpy(&word, bytes, sizeof(word));
+      mix(word);
+    }
+
+    if (length > 0) {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes, length);
+      mix(word);
+    }
+  }
+
+  uint64_t value() const {
+    uint64_t result = state ^ total;
+
+    result ^= result >> 33;
+    result *= 0xFF51AFD7ED558CCDull;
+    result ^= result >> 33;
+    result *= 0xC4CEB9FE1A85EC53ull;
+    result ^= result >> 33;
+
+    return result != 0 ? result : 1;
+  }
+
+private:
+  void mix(uint64_t word) {
+    word *= 0x87C37B91114253D5ull;
+    word = (word << 31) | (word >> 33);
+    word *= 0x4CF5AD432745937Full;
+
+    state ^= word;
+    state = ((state << 27) | (state >> 37)) * 5 + 0x52DCE729;
+  }
+
+  uint64_t state = 0x9E3779B97F4A7C15ull;
+  uint64_t total = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Values behind stable numeric handles: the slot index in the low 32 bits and the generation of the slot in the high 32
+// bits. Removing a value bumps the generation of its slot, so a handle to a removed value never finds whatever reuses
+// the slot later. Generations start at 1, so 0 is never a valid handle. Not synchronized.
+template <class Value>
+class HandleTable {
+public:
+  uint64_t insert(const Value& value) {
+    uint32_t index;
+
+    if (!free_slots.empty()) {
+      index = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      index = (uint32_t) slots.size();
+      slots.push_back(Slot { Value(), 1, false });
+    }
+
+    Slot& slot = slots[index];
+    slot.value = value;
+    slot.used = true;
+    count++;
+
+    return handle_of(index);
+  }
+
+  Value* find(uint64_t handle) {
+    return const_cast<Value*>(static_cast<const HandleTable*>(this)->find(handle));
+  }
+
+  const Value* find(uint64_t handle) const {
+    auto index = (uint32_t) handle;
+
+    if (index >= slots.size() || !slots[index].used || slots[index].generation != (uint32_t) (handle >> 32)) {
+      return nullptr;
+    }
+
+    return &slots[index].value;
+  }
+
+  bool erase(uint64_t handle) {
+    if (find(handle) == nullptr) {
+      return false;
+    }
+
+    Slot& slot = slots[(uint32_t) handle];
+    slot.value = Value();
+    slot.used = false;
+    // Skips 0 on wrap around, so the slot never hands out handle 0
+    slot.generation = slot.generation == UINT32_MAX ? 1 : slot.generation + 1;
+
+    free_slots.push_back((uint32_t) handle);
+    count--;
+    return true;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  void reserve(size_t capacity) {
+    slots.reserve(capacity);
+    free_slots.reserve(capacity);
+  }
+
+  // Calls function(handle, value) for every value in slot order
+  template <class Function>
+  void for_each(Function function) {
+    for (uint32_t i = 0; i < slots.size(); i++) {
+      if (slots[i].used) {
+        function(handle_of(i), slots[i].value);
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    Value value;
+    uint32_t generation;
+    bool used;
+  };
+
+  uint64_t handle_of(uint32_t index) const {
+    return ((uint64_t) slots[index].generation << 32) | index;
+  }
+
+  std::vector<Slot> slots;
+  std::vector<uint32_t> free_slots;
+  size_t count = 0;
+};
@@ -1,5 +1,6 @@
 #include "log.h"
 
+#include "../text/utf8.h"
 #include "../windows_api.h"
 #include <Psapi.h>
 #include <filesystem>
@@ -12,14 +13,16 @@ namespace fs = std::experimental::filesystem;
 #include <spdlog/async.h>
 
 namespace logger {
-  static std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> wide_converter;
-
   std::string wide(const std::wstring& value) {
-    return std::string(wide_converter.to_bytes(value));
+    std::string result;
+    utf8_append(result, value.data(), value.length());
+    return result;
   }
 
   std::string wide(const wchar_t* value) {
-    return std::string(wide_converter.to_bytes(value));
+    std::string result;
+    utf8_append(result, value, wcslen(value));
+    return result;
   }
 
   static void setup_logger_throw() {
@@ -18,6 +18,7 @@ extern "C" __declspec(dllexport) void InitializeMod() {
 
   tcp_server = tcp_server_create(3548);
   tcp_server->start();
+  tcp_server->serve_shared_memory("witcher-sandbox", 0x400000);
 
   ExecutableAddressSpace space;
   wrapper_space = new WrapperAddressSpace(space.create_wrapper_space());
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Recycles message buffers so that receiving small messages does not allocate. Buffers which grew beyond the size
+// limit are freed instead of kept, so one large message does not stay pinned in the pool.
+class BufferPool {
+public:
+  BufferPool(size_t max_buffers, size_t max_buffer_size) : max_buffers(max_buffers), max_buffer_size(max_buffer_size) {
+
+  }
+
+  std::vector<uint8_t> acquire(const uint8_t* data, size_t length) {
+    std::vector<uint8_t> buffer;
+
+    if (length <= max_buffer_size) {
+      std::lock_guard<std::mutex> guard(mutex);
+
+      if (!buffers.empty()) {
+        buffer = std::move(buffers.back());
+        buffers.pop_back();
+      }
+    }
+
+    buffer.assign(data, data + length);
+    return buffer;
+  }
+
+  void release(std::vector<uint8_t>&& buffer) {
+    if (buffer.capacity() == 0 || buffer.capacity() > max_buffer_size) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if (buffers.size() < max_buffers) {
+      buffers.push_back(std::move(buffer));
+    }
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t>> buffers;
+  size_t max_buffers;
+  size_t max_buffer_size;
+};
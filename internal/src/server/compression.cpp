@@ -0,0 +1,157 @@
+#include "compression.h"
+
+#include <cstring>
+
+static const size_t lz_min_match = 4;
+// A match may not start within the last 12 bytes, and the last 5 bytes are always literals
+static const size_t lz_match_start_margin = 12;
+static const size_t lz_literal_tail = 5;
+static const size_t lz_hash_bits = 12;
+
+static inline uint32_t lz_read32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint8_t* lz_write_length(uint8_t* out, size_t length) {
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+
+  *out++ = (uint8_t) length;
+  return out;
+}
+
+static inline uint8_t* lz_write_literals(uint8_t* out, const uint8_t* literals, size_t literal_length,
+                                         uint8_t match_nibble) {
+
+  *out++ = (uint8_t) ((literal_length < 15 ? literal_length : 15) << 4) | match_nibble;
+
+  if (literal_length >= 15) {
+    out = lz_write_length(out, literal_length - 15);
+  }
+
+  if (literal_length > 0) {
+    memcpy(out, literals, literal_length);
+  }
+
+  return out + literal_length;
+}
+
+void lz_compress(const uint8_t* input, size_t length, std::vector<uint8_t>& output) {
+  size_t base = output.size();
+  output.resize(base + length + length / 255 + 16);
+
+  uint8_t* out = &output[base];
+  uint32_t table[1 << lz_hash_bits] = {};
+
+  size_t anchor = 0;
+  size_t position = 1;
+
+  if (length > lz_match_start_margin) {
+    size_t match_start_limit = length - lz_match_start_margin;
+    size_t match_end_limit = length - lz_literal_tail;
+
+    while (position < match_start_limit) {
+      uint32_t sequence = lz_read32(&input[position]);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - lz_hash_bits);
+      size_t candidate = table[hash];
+      table[hash] = (uint32_t) position;
+
+      if (candidate >= position || position - candidate > 0xFFFF || lz_read32(&input[candidate]) != sequence) {
+        // Skip ahead faster the longer nothing has matched, which keeps incompressible data cheap
+        position += 1 + ((position - anchor) >> 6);
+        continue;
+      }
+
+      size_t match_length = lz_min_match;
+
+      while (position + match_length < match_end_limit && input[candidate + match_length] == input[position + match_length]) {
+        match_length++;
+      }
+
+      size_t extra_length = match_length - lz_min_match;
+      out = lz_write_literals(out, &input[anchor], position - anchor, (uint8_t) (extra_length < 15 ? extra_length : 15));
+
+      uint16_t offset = (uint16_t) (position - candidate);
+      memcpy(out, &offset, sizeof(offset));
+      out += sizeof(offset);
+
+      if (extra_length >= 15) {
+        out = lz_write_length(out, extra_length - 15);
+      }
+
+      position += match_length;
+      anchor = position;
+    }
+  }
+
+  out = lz_write_literals(out, &input[anchor], length - anchor, 0);
+  output.resize(out - output.data());
+}
+
+static inline bool lz_read_length(const uint8_t* input, size_t length, size_t& position, size_t& value) {
+  uint8_t byte;
+
+  do {
+    if (position >= length) {
+      return false;
+    }
+
+    byte = input[position++];
+    value += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+bool lz_decompress(const uint8_t* input, size_t length, std::vector<uint8_t>& output) {
+  size_t position = 0;
+
+  while (position < length) {
+    uint8_t token = input[position++];
+    size_t literal_length = token >> 4;
+
+    if (literal_length == 15 && !lz_read_length(input, length, position, literal_length)) {
+      return false;
+    } else if (literal_length > length - position) {
+      return false;
+    }
+
+    output.insert(output.end(), &input[position], &input[position] + literal_length);
+    position += literal_length;
+
+    if (position == length) {
+      return true;
+    } else if (length - position < 2) {
+      return false;
+    }
+
+    uint16_t offset;
+    memcpy(&offset, &input[position], sizeof(offset));
+    position += sizeof(offset);
+
+    size_t match_length = token & 0x0F;
+
+    if (match_length == 15 && !lz_read_length(input, length, position, match_length)) {
+      return false;
+    } else if (offset == 0 || offset > output.size()) {
+      return false;
+    }
+
+    match_length += lz_min_match;
+
+    size_t source = output.size() - offset;
+    size_t target = output.size();
+    output.resize(target + match_length);
+
+    // Matches may overlap their own output, so this has to go forward byte by byte
+    for (size_t i = 0; i < match_length; i++) {
+      output[target + i] = output[source + i];
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// LZ4 block format, so clients can decode with any LZ4 implementation. Output is appended to the given vector.
+void lz_compress(const uint8_t* input, size_t length, std::vector<uint8_t>& output);
+bool lz_decompress(const uint8_t* input, size_t length, std::vector<uint8_t>& output);
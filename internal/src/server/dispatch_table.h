@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Maps 16-bit message types to handlers through a two-level table of 256 pages with 256 slots each. Lookups only
+// read the currently published table and never lock. Registration copies the top level and the touched page and
+// publishes the copy. Superseded tables, pages and handlers are kept until destruction instead of being freed, as
+// readers are not tracked and registration only happens a handful of times.
+template <typename Handler>
+class DispatchTable {
+public:
+  DispatchTable() {
+    current.store(&tables.emplace_back(), std::memory_order_release);
+  }
+
+  const Handler* find(uint16_t type) const {
+    const Table* table = current.load(std::memory_order_acquire);
+    const Page* page = table->pages[type >> 8];
+
+    return page != nullptr ? page->slots[type & 0xFF] : nullptr;
+  }
+
+  void set(uint16_t type, Handler handler) {
+    std::lock_guard<std::mutex> guard(mutex);
+
+    const Table* previous = current.load(std::memory_order_relaxed);
+    const Page* previous_page = previous->pages[type >> 8];
+
+    Page& page = previous_page != nullptr ? pages.emplace_back(*previous_page) : pages.emplace_back();
+    page.slots[type & 0xFF] = &handlers.emplace_back(std::move(handler));
+
+    Table& table = tables.emplace_back(*previous);
+    table.pages[type >> 8] = &page;
+
+    current.store(&table, std::memory_order_release);
+  }
+
+private:
+  struct Page {
+    const Handler* slots[256] {};
+  };
+
+  struct Table {
+    const Page* pages[256] {};
+  };
+
+  std::mutex mutex;
+  std::deque<Handler> handlers;
+  std::deque<Page> pages;
+  std::deque<Table> tables;
+  std::atomic<const Table*> current;
+};
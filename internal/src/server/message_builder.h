@@ -2,7 +2,12 @@
 
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <algorithm>
+#include <type_traits>
 #include "../logging/log.h"
+#include "../text/utf8.h"
 
 template <class Type>
 std::vector<uint8_t>& message_append(std::vector<uint8_t>& message, const Type& value) {
@@ -11,19 +16,109 @@ std::vector<uint8_t>& message_append(std::vector<uint8_t>& message, const Type&
   return message;
 }
 
-std::vector<uint8_t>& message_append(std::vector<uint8_t>& message, const void* value, size_t length) {
+inline std::vector<uint8_t>& message_append(std::vector<uint8_t>& message, const void* value, size_t length) {
   auto value_array = reinterpret_cast<const uint8_t*>(value);
   message.insert(message.end(), value_array, value_array + length);
   return message;
 }
 
-std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const std::string& string) {
+inline std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const std::string& string) {
   uint32_t length = string.length();
   message_append(message, length);
   message_append(message, string.c_str(), length);
   return message;
 }
 
-std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const std::wstring& string) {
-  return message_append_string(message, logger::wide(string));
+// Transcodes straight into the message and fills in the length afterwards
+inline std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const wchar_t* string,
+                                                   size_t length) {
+  size_t offset = message.size();
+  message.resize(offset + sizeof(uint32_t));
+  utf8_append(message, string, length);
+
+  auto encoded_length = (uint32_t) (message.size() - offset - sizeof(uint32_t));
+  std::memcpy(&message[offset], &encoded_length, sizeof(encoded_length));
+  return message;
+}
+
+inline std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const wchar_t* string) {
+  return message_append_string(message, string, wcslen(string));
+}
+
+inline std::vector<uint8_t>& message_append_string(std::vector<uint8_t>& message, const std::wstring& string) {
+  return message_append_string(message, string.data(), string.length());
+}
+
+// Writes to the end of a message with plain copies. The message is grown by the expected length once up front and
+// only grows again if more than that is written, the unused part is trimmed off when the writer goes away.
+class MessageWriter {
+public:
+  MessageWriter(std::vector<uint8_t>& message, size_t expected_length) : message(message), offset(message.size()) {
+    message.resize(offset + expected_length);
+  }
+
+  ~MessageWriter() {
+    message.resize(offset);
+  }
+
+  MessageWriter(const MessageWriter&) = delete;
+  MessageWriter& operator=(const MessageWriter&) = delete;
+
+  void write(const void* value, size_t length) {
+    if (offset + length > message.size()) {
+      message.resize(std::max(offset + length, message.size() * 2));
+    }
+
+    if (length > 0) {
+      std::memcpy(&message[offset], value, length);
+      offset += length;
+    }
+  }
+
+  void write_string(const std::string& string) {
+    uint32_t length = string.length();
+    write(&length, sizeof(length));
+    write(string.data(), length);
+  }
+
+private:
+  std::vector<uint8_t>& message;
+  size_t offset;
+};
+
+// Serializers of fixed size types know their size at compile time, others compute it from the value, which lets the
+// whole message be reserved before writing it. Types are written as they are in memory, specialize this for types
+// which need another encoding, like WRenderParticleEmitter in emitter_encoding.h.
+template <class Type>
+struct MessageSerializer {
+  static_assert(std::is_trivially_copyable<Type>::value, "Type needs its own serializer");
+
+  static constexpr bool fixed = true;
+  static constexpr size_t fixed_size = sizeof(Type);
+
+  static size_t size(const Type& value) {
+    return sizeof(Type);
+  }
+
+  static void write(MessageWriter& writer, const Type& value) {
+    writer.write(&value, sizeof(Type));
+  }
+};
+
+template <class Type>
+size_t message_size(const Type& value) {
+  return MessageSerializer<Type>::size(value);
+}
+
+template <class Type>
+void message_write(MessageWriter& writer, const Type& value) {
+  MessageSerializer<Type>::write(writer, value);
+}
+
+// Appends the value with a single reservation for all of its fields
+template <class Type>
+std::vector<uint8_t>& message_append_fields(std::vector<uint8_t>& message, const Type& value) {
+  MessageWriter writer(message, message_size(value));
+  message_write(writer, value);
+  return message;
 }
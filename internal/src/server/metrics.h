@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Counts values in four buckets per power of two, so percentiles are within 25% of the real value. Recording is a
+// few relaxed atomic increments and never locks, reads may see a recording only partially applied.
+class Histogram {
+public:
+  void record(uint64_t value) {
+    buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t previous = maximum.load(std::memory_order_relaxed);
+
+    while (value > previous && !maximum.compare_exchange_weak(previous, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t count() const {
+    return total.load(std::memory_order_relaxed);
+  }
+
+  uint64_t value_sum() const {
+    return sum.load(std::memory_order_relaxed);
+  }
+
+  uint64_t max() const {
+    return maximum.load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket containing the given fraction of values
+  uint64_t percentile(double fraction) const {
+    uint64_t remaining = (uint64_t) (fraction * count()) + 1;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+      uint64_t bucket_values = buckets[i].load(std::memory_order_relaxed);
+
+      if (bucket_values >= remaining) {
+        uint64_t bound = bucket_upper_bound(i);
+        return bound < max() ? bound : max();
+      }
+
+      remaining -= bucket_values;
+    }
+
+    return max();
+  }
+
+private:
+  static const size_t bucket_count = 252;
+
+  static size_t bucket(uint64_t value) {
+    if (value < 4) {
+      return (size_t) value;
+    }
+
+    size_t top = highest_bit(value);
+    return (top - 1) * 4 + (size_t) ((value >> (top - 2)) & 3);
+  }
+
+  static uint64_t bucket_upper_bound(size_t index) {
+    if (index < 4) {
+      return index;
+    }
+
+    size_t top = index / 4 + 1;
+    return ((4 + index % 4 + 1) << (top - 2)) - 1;
+  }
+
+  static size_t highest_bit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+
+  std::atomic<uint64_t> buckets[bucket_count] {};
+  std::atomic<uint64_t> total { 0 };
+  std::atomic<uint64_t> sum { 0 };
+  std::atomic<uint64_t> maximum { 0 };
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+
+typedef SOCKET socket_handle;
+#else
+typedef int socket_handle;
+#endif
+
+extern const socket_handle invalid_socket_handle;
+
+enum class SocketStatus {
+  done,
+  would_block,
+  closed,
+  failed
+};
+
+struct SocketBuffer {
+  const void* data;
+  size_t length;
+};
+
+struct ReactorEvent {
+  void* context;
+  bool readable;
+  bool writable;
+  bool closed;
+};
+
+// Readiness notification for a set of non-blocking sockets. Everything except wake() must only be called from the
+// thread which calls wait(). Readiness is only guaranteed to be reported again after an operation on the socket has
+// returned SocketStatus::would_block, so callers must retry reads themselves after pausing them.
+class Reactor {
+public:
+  virtual ~Reactor() = default;
+  virtual bool watch(socket_handle handle, void* context, bool listener) = 0;
+  virtual void interest(socket_handle handle, bool read, bool write) = 0;
+  virtual void unwatch(socket_handle handle) = 0;
+  virtual bool wait(std::vector<ReactorEvent>& events, uint32_t timeout_ms) = 0;
+  virtual void wake() = 0;
+};
+
+Reactor* reactor_create();
+
+socket_handle socket_listen(uint16_t port);
+socket_handle socket_accept(socket_handle listener);
+void socket_close(socket_handle handle);
+SocketStatus socket_receive(socket_handle handle, void* buffer, size_t length, size_t& received);
+SocketStatus socket_send_vectored(socket_handle handle, const SocketBuffer* buffers, size_t count, size_t& sent);
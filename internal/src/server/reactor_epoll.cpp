@@ -0,0 +1,202 @@
+#ifndef _WIN32
+
+#include "reactor.h"
+#include "../logging/log.h"
+
+#include <unordered_map>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+const socket_handle invalid_socket_handle = -1;
+
+// Level-triggered, so a socket whose reads are paused must have its read interest dropped to avoid spinning. A peer
+// shutting down its side is reported as readable, for recv to return the rest of its data and then the shutdown, so
+// that whatever is still queued for it can be sent before closing. Only hangups and errors are reported as closed.
+class EpollReactor : public Reactor {
+public:
+  EpollReactor() {
+    epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+    wake_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &wake_handle;
+    epoll_ctl(epoll_handle, EPOLL_CTL_ADD, wake_handle, &event);
+  }
+
+  ~EpollReactor() override {
+    close(wake_handle);
+    close(epoll_handle);
+  }
+
+  bool watch(socket_handle handle, void* context, bool listener) override {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = context;
+
+    if (epoll_ctl(epoll_handle, EPOLL_CTL_ADD, handle, &event) != 0) {
+      logger::it->error("Reactor: failed to add socket to epoll set, error {}.", errno);
+      return false;
+    }
+
+    contexts[handle] = context;
+    return true;
+  }
+
+  void interest(socket_handle handle, bool read, bool write) override {
+    epoll_event event{};
+    event.events = (read ? EPOLLIN | EPOLLRDHUP : 0) | (write ? EPOLLOUT : 0);
+    event.data.ptr = contexts[handle];
+
+    epoll_ctl(epoll_handle, EPOLL_CTL_MOD, handle, &event);
+  }
+
+  void unwatch(socket_handle handle) override {
+    epoll_ctl(epoll_handle, EPOLL_CTL_DEL, handle, nullptr);
+    contexts.erase(handle);
+  }
+
+  bool wait(std::vector<ReactorEvent>& events, uint32_t timeout_ms) override {
+    events.clear();
+
+    int count = epoll_wait(epoll_handle, fired_events, sizeof(fired_events) / sizeof(fired_events[0]), (int) timeout_ms);
+
+    if (count < 0) {
+      if (errno == EINTR) {
+        return true;
+      }
+
+      logger::it->error("Reactor: wait failed, error {}.", errno);
+      return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+      const epoll_event& fired = fired_events[i];
+
+      if (fired.data.ptr == &wake_handle) {
+        uint64_t value;
+        (void) !read(wake_handle, &value, sizeof(value));
+        continue;
+      }
+
+      events.push_back({
+          fired.data.ptr,
+          (fired.events & (EPOLLIN | EPOLLRDHUP)) != 0,
+          (fired.events & EPOLLOUT) != 0,
+          (fired.events & (EPOLLHUP | EPOLLERR)) != 0
+      });
+    }
+
+    return true;
+  }
+
+  void wake() override {
+    uint64_t value = 1;
+    (void) !write(wake_handle, &value, sizeof(value));
+  }
+
+private:
+  int epoll_handle;
+  int wake_handle;
+  epoll_event fired_events[64];
+  std::unordered_map<socket_handle, void*> contexts;
+};
+
+Reactor* reactor_create() {
+  return new EpollReactor();
+}
+
+socket_handle socket_listen(uint16_t port) {
+  socket_handle handle = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if (handle < 0) {
+    logger::it->debug("Reactor: failed to create listen socket.");
+    return invalid_socket_handle;
+  }
+
+  int reuse = 1;
+  setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in bind_address{};
+  bind_address.sin_family = AF_INET,
+  bind_address.sin_port = htons(port),
+  bind_address.sin_addr.s_addr = INADDR_ANY;
+
+  if (bind(handle, (sockaddr*) &bind_address, sizeof(bind_address)) != 0) {
+    logger::it->debug("Reactor: failed to bind listen socket.");
+    close(handle);
+    return invalid_socket_handle;
+  }
+
+  if (listen(handle, SOMAXCONN) != 0) {
+    logger::it->debug("Reactor: failed to listen on listen socket.");
+    close(handle);
+    return invalid_socket_handle;
+  }
+
+  return handle;
+}
+
+socket_handle socket_accept(socket_handle listener) {
+  socket_handle peer = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (peer < 0) {
+    return invalid_socket_handle;
+  }
+
+  // Responses are written in one gathered send, so Nagle would only delay them
+  int no_delay = 1;
+  setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  return peer;
+}
+
+void socket_close(socket_handle handle) {
+  close(handle);
+}
+
+SocketStatus socket_receive(socket_handle handle, void* buffer, size_t length, size_t& received) {
+  ssize_t result = recv(handle, buffer, length, 0);
+
+  if (result == 0) {
+    return SocketStatus::closed;
+  } else if (result < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? SocketStatus::would_block : SocketStatus::failed;
+  }
+
+  received = result;
+  return SocketStatus::done;
+}
+
+SocketStatus socket_send_vectored(socket_handle handle, const SocketBuffer* buffers, size_t count, size_t& sent) {
+  iovec io_buffers[64];
+
+  if (count > sizeof(io_buffers) / sizeof(io_buffers[0])) {
+    count = sizeof(io_buffers) / sizeof(io_buffers[0]);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    io_buffers[i].iov_base = (void*) buffers[i].data;
+    io_buffers[i].iov_len = buffers[i].length;
+  }
+
+  msghdr header{};
+  header.msg_iov = io_buffers;
+  header.msg_iovlen = count;
+
+  ssize_t result = sendmsg(handle, &header, MSG_NOSIGNAL);
+
+  if (result < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? SocketStatus::would_block : SocketStatus::failed;
+  }
+
+  sent = result;
+  return SocketStatus::done;
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifdef _WIN32
+
+#include "reactor.h"
+#include "../logging/log.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+const socket_handle invalid_socket_handle = INVALID_SOCKET;
+
+static const uint32_t winsock_hangup_poll_ms = 10;
+
+struct WinsockReactorEntry {
+  socket_handle handle;
+  void* context;
+  SHORT events;
+  // The peer shut down its side, which WSAPoll reports as POLLHUP on every wait from then on
+  bool hung_up;
+  bool skip_wait;
+};
+
+// Level-triggered like epoll, so a socket whose reads are paused must have its read interest dropped to avoid spinning.
+// WSAPoll only takes sockets, so wake() sends a datagram to a loopback UDP socket which is polled along with the peers.
+// Unlike waiting on event objects, this has no limit of 64 handles, at the cost of passing every socket on each wait.
+// A peer shutting down its side is reported as readable like with epoll, for recv to return the rest of its data and
+// then the shutdown. POLLHUP cannot be masked, so once the socket is no longer read, it is left out of the wait while
+// nothing is to be written, and otherwise polled for writing every 10 ms instead of on every wait.
+class WinsockReactor : public Reactor {
+public:
+  WinsockReactor() {
+    WSADATA startup_data;
+    started = WSAStartup(MAKEWORD(2,2), &startup_data) == 0;
+
+    wake_handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    sockaddr_in wake_address{};
+    int wake_address_length = sizeof(wake_address);
+    wake_address.sin_family = AF_INET;
+    wake_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    u_long non_blocking = 1;
+
+    if (wake_handle == INVALID_SOCKET || bind(wake_handle, (sockaddr*) &wake_address, sizeof(wake_address)) != 0 ||
+        getsockname(wake_handle, (sockaddr*) &wake_address, &wake_address_length) != 0 ||
+        connect(wake_handle, (sockaddr*) &wake_address, sizeof(wake_address)) != 0 ||
+        ioctlsocket(wake_handle, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+      logger::it->error("Reactor: failed to create wake socket, error {}.", WSAGetLastError());
+    }
+  }
+
+  ~WinsockReactor() override {
+    closesocket(wake_handle);
+
+    if (started) {
+      WSACleanup();
+    }
+  }
+
+  bool watch(socket_handle handle, void* context, bool listener) override {
+    indices[handle] = entries.size();
+    entries.push_back({ handle, context, POLLRDNORM, false, false });
+    return true;
+  }
+
+  void interest(socket_handle handle, bool read, bool write) override {
+    auto it = indices.find(handle);
+
+    if (it != indices.end()) {
+      entries[it->second].events = (SHORT) ((read ? POLLRDNORM : 0) | (write ? POLLWRNORM : 0));
+    }
+  }
+
+  void unwatch(socket_handle handle) override {
+    auto it = indices.find(handle);
+
+    if (it == indices.end()) {
+      return;
+    }
+
+    size_t index = it->second;
+    indices.erase(it);
+
+    if (index + 1 < entries.size()) {
+      entries[index] = entries.back();
+      indices[entries[index].handle] = index;
+    }
+
+    entries.pop_back();
+  }
+
+  bool wait(std::vector<ReactorEvent>& events, uint32_t timeout_ms) override {
+    events.clear();
+    poll_handles.clear();
+    polled.clear();
+
+    poll_handles.push_back({ wake_handle, POLLRDNORM, 0 });
+
+    for (size_t i = 0; i < entries.size(); i++) {
+      WinsockReactorEntry& entry = entries[i];
+
+      if (entry.hung_up && (entry.events & POLLRDNORM) == 0) {
+        if ((entry.events & POLLWRNORM) == 0) {
+          continue;
+        } else if (entry.skip_wait) {
+          entry.skip_wait = false;
+          timeout_ms = std::min(timeout_ms, winsock_hangup_poll_ms);
+          continue;
+        }
+      }
+
+      poll_handles.push_back({ entry.handle, entry.events, 0 });
+      polled.push_back(i);
+    }
+
+    int count = WSAPoll(poll_handles.data(), (ULONG) poll_handles.size(), (INT) timeout_ms);
+
+    if (count == SOCKET_ERROR) {
+      logger::it->error("Reactor: wait failed, error {}.", WSAGetLastError());
+      return false;
+    }
+
+    if (count > 0 && poll_handles[0].revents != 0) {
+      char wake_buffer[16];
+
+      while (recv(wake_handle, wake_buffer, sizeof(wake_buffer), 0) > 0) {
+
+      }
+    }
+
+    for (size_t i = 0; i < polled.size(); i++) {
+      WinsockReactorEntry& entry = entries[polled[i]];
+      SHORT fired = poll_handles[i + 1].revents;
+      bool read = (entry.events & POLLRDNORM) != 0;
+
+      if ((fired & POLLHUP) != 0) {
+        // Writing after the hangup either still works or fails in send, which the caller notices either way
+        entry.hung_up = true;
+        entry.skip_wait = !read && (fired & POLLWRNORM) == 0;
+      }
+
+      bool readable = (fired & POLLRDNORM) != 0 || (read && (fired & POLLHUP) != 0);
+      bool writable = (fired & POLLWRNORM) != 0;
+      bool closed = (fired & (POLLERR | POLLNVAL)) != 0;
+
+      if (readable || writable || closed) {
+        events.push_back({ entry.context, readable, writable, closed });
+      }
+    }
+
+    return true;
+  }
+
+  void wake() override {
+    char value = 1;
+    send(wake_handle, &value, sizeof(value), 0);
+  }
+
+private:
+  bool started;
+  socket_handle wake_handle;
+  std::vector<WinsockReactorEntry> entries;
+  // Rebuilt on every wait, the wake socket comes first, then the entries listed in polled
+  std::vector<WSAPOLLFD> poll_handles;
+  std::vector<size_t> polled;
+  std::unordered_map<socket_handle, size_t> indices;
+};
+
+Reactor* reactor_create() {
+  return new WinsockReactor();
+}
+
+static bool socket_configure(socket_handle handle) {
+  u_long non_blocking = 1;
+  return ioctlsocket(handle, FIONBIO, &non_blocking) != SOCKET_ERROR;
+}
+
+socket_handle socket_listen(uint16_t port) {
+  socket_handle handle = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, 0);
+
+  if (handle == INVALID_SOCKET) {
+    WSADATA startup_data;
+    WSAStartup(MAKEWORD(2,2), &startup_data);
+
+    handle = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, 0);
+
+    if (handle == INVALID_SOCKET) {
+      logger::it->debug("Reactor: failed to create listen socket.");
+      return INVALID_SOCKET;
+    }
+  }
+
+  if (!socket_configure(handle)) {
+    logger::it->debug("Reactor: failed to set listen socket to non-blocking.");
+    closesocket(handle);
+    return INVALID_SOCKET;
+  }
+
+  sockaddr_in bind_address{};
+  bind_address.sin_family = AF_INET,
+  bind_address.sin_port = htons(port),
+  bind_address.sin_addr.s_addr = INADDR_ANY;
+
+  if (bind(handle, (sockaddr*) &bind_address, sizeof(bind_address)) == SOCKET_ERROR) {
+    logger::it->debug("Reactor: failed to bind listen socket.");
+    closesocket(handle);
+    return INVALID_SOCKET;
+  }
+
+  if (listen(handle, SOMAXCONN) == SOCKET_ERROR) {
+    logger::it->debug("Reactor: failed to listen on listen socket.");
+    closesocket(handle);
+    return INVALID_SOCKET;
+  }
+
+  return handle;
+}
+
+socket_handle socket_accept(socket_handle listener) {
+  socket_handle peer = WSAAccept(listener, nullptr, nullptr, nullptr, 0);
+
+  if (peer != INVALID_SOCKET && !socket_configure(peer)) {
+    logger::it->debug("Reactor: failed to set peer socket to non-blocking.");
+    closesocket(peer);
+    return INVALID_SOCKET;
+  }
+
+  if (peer != INVALID_SOCKET) {
+    // Responses are written in one gathered send, so Nagle would only delay them
+    BOOL no_delay = TRUE;
+    setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, (const char*) &no_delay, sizeof(no_delay));
+  }
+
+  return peer;
+}
+
+void socket_close(socket_handle handle) {
+  closesocket(handle);
+}
+
+SocketStatus socket_receive(socket_handle handle, void* buffer, size_t length, size_t& received) {
+  int32_t result = recv(handle, (char*) buffer, (int) length, 0);
+
+  if (result == 0) {
+    return SocketStatus::closed;
+  } else if (result == SOCKET_ERROR) {
+    return WSAGetLastError() == WSAEWOULDBLOCK ? SocketStatus::would_block : SocketStatus::failed;
+  }
+
+  received = result;
+  return SocketStatus::done;
+}
+
+SocketStatus socket_send_vectored(socket_handle handle, const SocketBuffer* buffers, size_t count, size_t& sent) {
+  WSABUF wsa_buffers[64];
+
+  if (count > sizeof(wsa_buffers) / sizeof(wsa_buffers[0])) {
+    count = sizeof(wsa_buffers) / sizeof(wsa_buffers[0]);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    wsa_buffers[i].buf = (CHAR*) buffers[i].data;
+    wsa_buffers[i].len = (ULONG) buffers[i].length;
+  }
+
+  DWORD result = 0;
+
+  if (WSASend(handle, wsa_buffers, (DWORD) count, &result, 0, nullptr, nullptr) == SOCKET_ERROR) {
+    return WSAGetLastError() == WSAEWOULDBLOCK ? SocketStatus::would_block : SocketStatus::failed;
+  }
+
+  sent = result;
+  return SocketStatus::done;
+}
+
+#endif
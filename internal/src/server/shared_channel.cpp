@@ -0,0 +1,116 @@
+#include "shared_channel.h"
+
+#include <cstring>
+#include <algorithm>
+
+static const uint32_t shared_channel_magic = 0x4D485357;
+static const size_t shared_channel_header_size = 0x200;
+static const uint32_t shared_channel_wait_ms = 10;
+
+template <typename T>
+static std::atomic<T>* shared_atomic(uint8_t* base, size_t offset) {
+  return reinterpret_cast<std::atomic<T>*>(base + offset);
+}
+
+SharedChannel::SharedChannel(std::unique_ptr<SharedMemory> memory, uint32_t capacity, const std::atomic<bool>& stopping)
+    : memory(std::move(memory)), capacity(capacity), stopping(stopping) {
+
+  uint8_t* base = this->memory->data();
+  memset(base, 0, shared_channel_header_size);
+
+  client_session = shared_atomic<uint32_t>(base, 0x40);
+  server_session = shared_atomic<uint32_t>(base, 0x80);
+  requests = { shared_atomic<uint64_t>(base, 0xC0), shared_atomic<uint64_t>(base, 0x100), base + 0x200 };
+  responses = { shared_atomic<uint64_t>(base, 0x140), shared_atomic<uint64_t>(base, 0x180), base + 0x200 + capacity };
+
+  *(uint32_t*) &base[4] = capacity;
+  shared_atomic<uint32_t>(base, 0)->store(shared_channel_magic, std::memory_order_release);
+}
+
+size_t SharedChannel::region_size(uint32_t capacity) {
+  return shared_channel_header_size + 2 * (size_t) capacity;
+}
+
+SharedChannelAccept SharedChannel::accept() {
+  uint32_t client = client_session->load(std::memory_order_acquire);
+
+  if (client != 0 && client == server_session->load(std::memory_order_relaxed)) {
+    return shared_channel_attached;
+  } else if (client == 0 || client == rejected_session) {
+    memory->wait(0, shared_channel_wait_ms);
+    return shared_channel_waiting;
+  }
+
+  // The client does not touch the rings before it sees its session acknowledged
+  requests.write_position->store(0, std::memory_order_relaxed);
+  requests.read_position->store(0, std::memory_order_relaxed);
+  responses.write_position->store(0, std::memory_order_relaxed);
+  responses.read_position->store(0, std::memory_order_relaxed);
+  server_session->store(client, std::memory_order_release);
+  return shared_channel_started;
+}
+
+void SharedChannel::reject() {
+  rejected_session = server_session->exchange(0, std::memory_order_acq_rel);
+}
+
+bool SharedChannel::attached() {
+  uint32_t server = server_session->load(std::memory_order_relaxed);
+  return !stopping && server != 0 && client_session->load(std::memory_order_acquire) == server;
+}
+
+bool SharedChannel::receive(uint8_t* buffer, size_t length) {
+  while (length > 0) {
+    uint64_t read = requests.read_position->load(std::memory_order_relaxed);
+    uint64_t available = requests.write_position->load(std::memory_order_acquire) - read;
+
+    if (available == 0) {
+      if (!attached()) {
+        return false;
+      }
+
+      memory->wait(0, shared_channel_wait_ms);
+      continue;
+    }
+
+    size_t offset = read % capacity;
+    size_t count = std::min<uint64_t>(std::min<uint64_t>(available, length), capacity - offset);
+
+    memcpy(buffer, &requests.data[offset], count);
+    requests.read_position->store(read + count, std::memory_order_release);
+    memory->signal(1);
+
+    buffer += count;
+    length -= count;
+  }
+
+  return true;
+}
+
+bool SharedChannel::send(const uint8_t* data, size_t length) {
+  while (length > 0) {
+    if (!attached()) {
+      return false;
+    }
+
+    uint64_t write = responses.write_position->load(std::memory_order_relaxed);
+    uint64_t space = capacity - (write - responses.read_position->load(std::memory_order_acquire));
+
+    if (space == 0) {
+      memory->wait(3, shared_channel_wait_ms);
+      continue;
+    }
+
+    size_t offset = write % capacity;
+    size_t count = std::min<uint64_t>(std::min<uint64_t>(space, length), capacity - offset);
+
+    memcpy(&responses.data[offset], data, count);
+    responses.write_position->store(write + count, std::memory_order_release);
+    memory->signal(2);
+
+    data += count;
+    length -= count;
+  }
+
+  return true;
+}
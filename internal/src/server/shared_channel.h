@@ -0,0 +1,58 @@
+#pragma once
+
+#include "shared_memory.h"
+
+#include <atomic>
+#include <memory>
+
+enum SharedChannelAccept {
+  // No client is attached
+  shared_channel_waiting,
+  // The client of the previous call is still attached
+  shared_channel_attached,
+  // A new client session started, anything remembered about the previous one no longer applies
+  shared_channel_started
+};
+
+// A byte stream in each direction through shared memory, carrying the same messages as a TCP connection without
+// request IDs. Layout of the region, little endian:
+//   0x000  uint32_t magic 0x4D485357, uint32_t ring capacity
+//   0x040  uint32_t client session, a client attaches by writing a new non-zero value here
+//   0x080  uint32_t server session, equals the client session once both rings have been reset for that client
+//   0x0C0  uint64_t request write position, 0x100 uint64_t request read position
+//   0x140  uint64_t response write position, 0x180 uint64_t response read position
+//   0x200  request ring, followed by the response ring
+// Positions only grow, the offset in a ring is the position modulo the capacity. Event 0 is signaled when requests
+// are written, 1 when they are read, 2 when responses are written and 3 when they are read.
+class SharedChannel {
+public:
+  SharedChannel(std::unique_ptr<SharedMemory> memory, uint32_t capacity, const std::atomic<bool>& stopping);
+
+  static size_t region_size(uint32_t capacity);
+
+  // Waits briefly for a client, resetting the rings if a new one has attached
+  SharedChannelAccept accept();
+  // Stops serving the current client, until it attaches again with a new session
+  void reject();
+  // Both fail if the client went away or the server is stopping
+  bool receive(uint8_t* buffer, size_t length);
+  bool send(const uint8_t* data, size_t length);
+
+private:
+  struct Ring {
+    std::atomic<uint64_t>* write_position;
+    std::atomic<uint64_t>* read_position;
+    uint8_t* data;
+  };
+
+  bool attached();
+
+  std::unique_ptr<SharedMemory> memory;
+  uint32_t capacity;
+  const std::atomic<bool>& stopping;
+  std::atomic<uint32_t>* client_session;
+  std::atomic<uint32_t>* server_session;
+  uint32_t rejected_session = 0;
+  Ring requests;
+  Ring responses;
+};
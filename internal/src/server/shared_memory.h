@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// A named memory region which other processes on the same machine can map, with four named events to wake them.
+// An event stays signaled until one waiter wakes up, waits may also end early or late, so waiters must re-check.
+class SharedMemory {
+public:
+  virtual ~SharedMemory() = default;
+  virtual uint8_t* data() = 0;
+  virtual void signal(uint32_t event) = 0;
+  virtual void wait(uint32_t event, uint32_t timeout_ms) = 0;
+};
+
+SharedMemory* shared_memory_create(const std::string& name, size_t size);
@@ -0,0 +1,72 @@
+#ifndef _WIN32
+
+#include "shared_memory.h"
+#include "../logging/log.h"
+
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Mapped as /dev/shm/<name>. There are no named events, so waits are short sleeps and signals do nothing, which is
+// good enough for testing on Linux.
+class PosixSharedMemory : public SharedMemory {
+public:
+  PosixSharedMemory(std::string path, uint8_t* view, size_t size) : path(std::move(path)), view(view), size(size) {
+
+  }
+
+  ~PosixSharedMemory() override {
+    munmap(view, size);
+    shm_unlink(path.c_str());
+  }
+
+  uint8_t* data() override {
+    return view;
+  }
+
+  void signal(uint32_t event) override {
+
+  }
+
+  void wait(uint32_t event, uint32_t timeout_ms) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms < 1 ? timeout_ms : 1));
+  }
+
+private:
+  std::string path;
+  uint8_t* view;
+  size_t size;
+};
+
+SharedMemory* shared_memory_create(const std::string& name, size_t size) {
+  std::string path = "/" + name;
+  int handle = shm_open(path.c_str(), O_CREAT | O_RDWR, 0600);
+
+  if (handle < 0) {
+    logger::it->error("Shared memory: failed to open {}, error {}.", path, errno);
+    return nullptr;
+  }
+
+  if (ftruncate(handle, size) != 0) {
+    logger::it->error("Shared memory: failed to resize {}, error {}.", path, errno);
+    close(handle);
+    shm_unlink(path.c_str());
+    return nullptr;
+  }
+
+  void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+  close(handle);
+
+  if (view == MAP_FAILED) {
+    logger::it->error("Shared memory: failed to map {}, error {}.", path, errno);
+    shm_unlink(path.c_str());
+    return nullptr;
+  }
+
+  return new PosixSharedMemory(path, (uint8_t*) view, size);
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifdef _WIN32
+
+#include "shared_memory.h"
+#include "../logging/log.h"
+
+#include <Windows.h>
+
+// Mapped as Local\<name>, the events are Local\<name>.0 to Local\<name>.3
+class WindowsSharedMemory : public SharedMemory {
+public:
+  WindowsSharedMemory(HANDLE mapping, uint8_t* view, HANDLE* created_events) : mapping(mapping), view(view) {
+    for (size_t i = 0; i < 4; i++) {
+      events[i] = created_events[i];
+    }
+  }
+
+  ~WindowsSharedMemory() override {
+    for (HANDLE event : events) {
+      CloseHandle(event);
+    }
+
+    UnmapViewOfFile(view);
+    CloseHandle(mapping);
+  }
+
+  uint8_t* data() override {
+    return view;
+  }
+
+  void signal(uint32_t event) override {
+    SetEvent(events[event]);
+  }
+
+  void wait(uint32_t event, uint32_t timeout_ms) override {
+    WaitForSingleObject(events[event], timeout_ms);
+  }
+
+private:
+  HANDLE mapping;
+  uint8_t* view;
+  HANDLE events[4];
+};
+
+SharedMemory* shared_memory_create(const std::string& name, size_t size) {
+  std::string path = "Local\\" + name;
+  HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD) ((uint64_t) size >> 32),
+                                      (DWORD) size, path.c_str());
+
+  if (mapping == nullptr) {
+    logger::it->error("Shared memory: failed to create mapping {}, error {}.", path, GetLastError());
+    return nullptr;
+  }
+
+  auto view = (uint8_t*) MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+
+  if (view == nullptr) {
+    logger::it->error("Shared memory: failed to map {}, error {}.", path, GetLastError());
+    CloseHandle(mapping);
+    return nullptr;
+  }
+
+  HANDLE events[4] {};
+
+  for (size_t i = 0; i < 4; i++) {
+    std::string event_name = fmt::format("{}.{}", path, i);
+    events[i] = CreateEventA(nullptr, FALSE, FALSE, event_name.c_str());
+
+    if (events[i] == nullptr) {
+      logger::it->error("Shared memory: failed to create event {}, error {}.", event_name, GetLastError());
+
+      for (size_t j = 0; j < i; j++) {
+        CloseHandle(events[j]);
+      }
+
+      UnmapViewOfFile(view);
+      CloseHandle(mapping);
+      return nullptr;
+    }
+  }
+
+  return new WindowsSharedMemory(mapping, view, events);
+}
+
+#endif
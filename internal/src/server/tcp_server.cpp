@@ -1,11 +1,33 @@
 #include <utility>
 
 #include "tcp_server.h"
+#include "reactor.h"
+#include "worker_pool.h"
+#include "dispatch_table.h"
+#include "compression.h"
+#include "shared_channel.h"
+#include "metrics.h"
+#include "buffer_pool.h"
 #include "../logging/log.h"
 
 #include <thread>
 #include <mutex>
-#include <WinSock2.h>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+static const size_t tcp_worker_count = 4;
+static const uint32_t tcp_peer_request_limit = 16;
+static const size_t tcp_compression_threshold = 0x100;
+static const std::chrono::seconds tcp_metrics_interval(60);
+static const std::chrono::seconds tcp_send_stall_timeout(10);
+static const size_t tcp_receive_buffer_size = 0x10000;
+static const size_t tcp_message_length_limit = 0x100000;
 
 class OnLeave {
 public:
@@ -21,27 +43,249 @@ private:
   std::function<void ()> function;
 };
 
+struct TcpPeer;
+struct TcpInboundMessage;
+
+typedef std::function<void(const std::shared_ptr<TcpPeer>&, const TcpInboundMessage&,
+                           const TcpMessageSender&)> TcpPeerHandler;
+
+// Histograms of every dispatch of one message type: handler time and send wait time in nanoseconds, message and
+// response sizes in bytes. Send wait is the time spent in sends and stream writes, and is part of the handler time.
+struct TcpTypeMetrics {
+  explicit TcpTypeMetrics(uint16_t type) : type(type) {
+
+  }
+
+  uint16_t type;
+  std::atomic<uint64_t> errors { 0 };
+  Histogram handler_time;
+  Histogram bytes_in;
+  Histogram bytes_out;
+  Histogram send_wait;
+};
+
+// Server-internal handlers which need the peer itself use peer_handler
+struct TcpHandlerEntry {
+  TcpMessageHandler handler;
+  TcpStreamHandler stream_handler;
+  TcpPeerHandler peer_handler;
+  TcpTypeMetrics* metrics;
+};
+
+// Collected over one dispatch and recorded into the metrics when the handler returns
+struct TcpDispatchRecord {
+  uint64_t bytes_out = 0;
+  uint64_t send_wait = 0;
+};
+
+class TcpSendTimer {
+public:
+  TcpSendTimer(TcpDispatchRecord& record, size_t bytes) : record(record), start(std::chrono::steady_clock::now()) {
+    record.bytes_out += bytes;
+  }
+
+  ~TcpSendTimer() {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record.send_wait += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  }
+
+private:
+  TcpDispatchRecord& record;
+  std::chrono::steady_clock::time_point start;
+};
+
+struct TcpCompressionStats {
+  uint32_t messages;
+  uint64_t original_bytes;
+  uint64_t compressed_bytes;
+  uint64_t nanoseconds;
+};
+
+// Queued bytes are summed over all peers, the peak is the most any single peer had queued
+struct TcpSendQueueStats {
+  std::atomic<uint64_t> queued_bytes { 0 };
+  std::atomic<uint64_t> peak_bytes { 0 };
+  std::atomic<uint64_t> pauses { 0 };
+  std::atomic<uint64_t> dropped_pushes { 0 };
+  std::atomic<uint64_t> evicted_peers { 0 };
+};
+
+struct TcpInboundMessage {
+  uint16_t type;
+  uint32_t request_id;
+  std::vector<uint8_t> body;
+};
+
+struct TcpOutboundFrame {
+  uint8_t header[10];
+  uint8_t header_length;
+  std::shared_ptr<const std::vector<uint8_t>> body;
+};
+
+struct TcpPeer {
+  explicit TcpPeer(socket_handle handle) : handle(handle) {
+
+  }
+
+  // Only touched by the reactor thread. Messages are parsed from the receive buffer, except for the rest of a body
+  // which does not fit in it, that is received straight into the message body.
+  size_t header_length = 6;
+  std::vector<uint8_t> receive_buffer;
+  size_t receive_start = 0;
+  size_t receive_end = 0;
+  uint16_t body_type = 0;
+  uint32_t body_request_id = 0;
+  std::vector<uint8_t> body;
+  size_t body_received = 0;
+  bool receiving_body = false;
+  bool read_interest = true;
+  bool write_interest = false;
+
+  // Everything below is guarded by the mutex
+  std::mutex mutex;
+  socket_handle handle;
+  bool failed = false;
+  bool scheduled = false;
+  bool request_ids = false;
+  bool streaming = false;
+  bool compression = false;
+  bool switching = false;
+  bool draining = false;
+  // The peer has shut down its side, what it sent before is still answered and the socket closed once that is sent
+  bool read_closed = false;
+  uint32_t in_flight = 0;
+  std::deque<TcpInboundMessage> inbox;
+  std::deque<TcpOutboundFrame> outbound;
+  size_t outbound_sent = 0;
+  size_t outbound_bytes = 0;
+  bool write_blocked = false;
+  bool send_paused = false;
+  std::chrono::steady_clock::time_point send_progress;
+  std::condition_variable drained;
+};
+
 class ActualTcpServer : public TcpServer {
 public:
-  explicit ActualTcpServer(uint16_t port): port(port), stop_event(nullptr) {
-    std::lock_guard<std::mutex> guard(mutex);
-    stop_event = CreateEventW(nullptr, true, false, nullptr);
+  explicit ActualTcpServer(uint16_t port): receive_pool(256, tcp_receive_buffer_size), port(port) {
+    unknown_metrics = &metrics.emplace_back(1);
+
+    set_handler(14, { std::bind(&ActualTcpServer::message_compression_stats, this, std::placeholders::_1,
+        std::placeholders::_2, std::placeholders::_3) });
+    set_handler(16, { nullptr, nullptr, std::bind(&ActualTcpServer::peer_subscribe, this, std::placeholders::_1,
+        std::placeholders::_2, std::placeholders::_3) });
+    set_handler(22, { std::bind(&ActualTcpServer::message_metrics, this, std::placeholders::_1,
+        std::placeholders::_2, std::placeholders::_3) });
+    set_handler(24, { std::bind(&ActualTcpServer::message_send_queue_stats, this, std::placeholders::_1,
+        std::placeholders::_2, std::placeholders::_3) });
   }
 
   ~ActualTcpServer() override {
-    std::unique_lock<std::mutex> guard(mutex);
-    SetEvent(stop_event);
+    {
+      std::unique_lock<std::mutex> guard(mutex);
+      stopping = true;
+
+      if (reactor != nullptr) {
+        reactor->wake();
+      }
 
-    while(thread_count > 0) {
-      condition.wait(guard);
+      while(thread_count > 0) {
+        condition.wait(guard);
+      }
     }
+
+    workers.reset();
   }
 
   void add_handler(uint16_t type, TcpMessageHandler handler) override {
     logger::it->error("TCP server: registering handler for message type {}.", type);
 
+    set_handler(type, { std::move(handler) });
+  }
+
+  void add_stream_handler(uint16_t type, TcpStreamHandler handler) override {
+    logger::it->error("TCP server: registering stream handler for message type {}.", type);
+
+    set_handler(type, { nullptr, std::move(handler) });
+  }
+
+  void set_coalescing_limit(uint32_t bytes) override {
+    coalescing_limit = bytes;
+  }
+
+  void set_send_limits(uint32_t low_watermark, uint32_t high_watermark, TcpSlowPeerPolicy policy,
+                       uint32_t stream_stall_ms) override {
+    send_low_watermark = std::min(low_watermark, high_watermark);
+    send_high_watermark = high_watermark;
+    slow_peer_policy = policy;
+    stream_stall_time = std::max(stream_stall_ms, 1u);
+  }
+
+  void serve_shared_memory(const std::string& name, uint32_t capacity) override {
+    SharedMemory* memory = shared_memory_create(name, SharedChannel::region_size(capacity));
+
+    if (memory == nullptr) {
+      logger::it->error("TCP server: failed to set up shared memory channel {}.", name);
+      return;
+    }
+
+    logger::it->info("TCP server: serving shared memory channel {}.", name);
+
+    auto channel = std::make_shared<SharedChannel>(std::unique_ptr<SharedMemory>(memory), capacity, stopping);
     std::lock_guard<std::mutex> guard(mutex);
-    handlers[type] = handler;
+
+    if (!try_start_thread([this, channel] { channel_handler(*channel); })) {
+      logger::it->error("TCP server: failed to start shared memory channel thread.");
+    }
+  }
+
+  void publish(uint16_t type, std::shared_ptr<const std::vector<uint8_t>> message) override {
+    // Held throughout, so that nothing is pushed to a peer after it has been told it unsubscribed
+    std::lock_guard<std::mutex> subscriptions_guard(subscriptions_mutex);
+
+    auto it = subscriptions.find(type);
+
+    if (it == subscriptions.end()) {
+      return;
+    }
+
+    for (const auto& subscriber : it->second) {
+      std::shared_ptr<TcpPeer> peer = subscriber.lock();
+
+      if (peer == nullptr) {
+        continue;
+      }
+
+      std::lock_guard<std::mutex> guard(peer->mutex);
+
+      // The publisher must never wait, so a subscriber which stopped reading either misses the message or is dropped
+      if (peer->outbound_bytes >= send_high_watermark) {
+        if (slow_peer_policy == tcp_slow_peer_drop) {
+          send_stats.dropped_pushes.fetch_add(1, std::memory_order_relaxed);
+        } else if (!peer->failed) {
+          logger::it->warn("TCP server: subscriber is not keeping up with message type {}, closing.", type);
+          peer->failed = true;
+          send_stats.evicted_peers.fetch_add(1, std::memory_order_relaxed);
+          peer_schedule(peer);
+        }
+
+        continue;
+      }
+
+      if (!peer_send(*peer, type, 0, *message, peer->request_ids, message)) {
+        continue;
+      }
+
+      bool was_blocked = peer->write_blocked;
+      bool was_paused = peer->send_paused;
+
+      if (!peer_flush(*peer)) {
+        peer->failed = true;
+      }
+
+      if (was_blocked != peer->write_blocked || was_paused != peer->send_paused || peer->failed) {
+        peer_schedule(peer);
+      }
+    }
   }
 
   void start() override {
@@ -51,9 +295,11 @@ public:
       logger::it->info("TCP server: starting on port {}.", port);
 
       started = true;
+      reactor.reset(reactor_create());
+      workers = std::make_unique<WorkerPool>(tcp_worker_count);
 
-      if (!try_start_thread(std::bind(&ActualTcpServer::accept_handler, this))) {
-        logger::it->error("TCP server: failed to start accept thread.");
+      if (!try_start_thread(std::bind(&ActualTcpServer::reactor_handler, this))) {
+        logger::it->error("TCP server: failed to start reactor thread.");
       }
     } else {
       logger::it->error("TCP server: already started, not starting.");
@@ -61,6 +307,175 @@ public:
   }
 
 private:
+  class PeerStream : public TcpMessageStream {
+  public:
+    PeerStream(ActualTcpServer& server, const std::shared_ptr<TcpPeer>& peer, uint32_t request_id,
+               TcpDispatchRecord& record) : server(server), peer(peer), request_id(request_id), record(record) {
+
+    }
+
+    bool begin(uint16_t type) override {
+      TcpSendTimer timer(record, 0);
+      std::lock_guard<std::mutex> guard(peer->mutex);
+
+      this->type = type;
+      streaming = peer->streaming;
+
+      if (streaming) {
+        std::vector<uint8_t> message(2);
+        *(uint16_t*) &message[0] = type;
+
+        return server.peer_send(*peer, 3, request_id, message, peer->request_ids);
+      }
+
+      buffered.clear();
+      return !peer->failed;
+    }
+
+    bool append(const std::vector<uint8_t>& chunk) override {
+      if (!streaming) {
+        buffered.insert(buffered.end(), chunk.begin(), chunk.end());
+        return true;
+      } else if (chunk.empty()) {
+        return true;
+      }
+
+      TcpSendTimer timer(record, chunk.size());
+      uint16_t frame_type = 4;
+      const std::vector<uint8_t>& frame = server.peer_compress(*peer, frame_type, chunk, compressed);
+
+      std::unique_lock<std::mutex> guard(peer->mutex);
+
+      if (!server.peer_send(*peer, frame_type, request_id, frame, peer->request_ids)) {
+        return false;
+      }
+
+      flush();
+
+      auto drained = [this] { return peer->failed || !peer->send_paused; };
+
+      // Waiting holds a worker, so under the disconnect policy a peer which takes none of its queued bytes for the
+      // stream stall time is closed. A peer which keeps taking bytes, however slowly, is waited for. Under the drop
+      // policy only the reactor's stall check ends the wait.
+      while (!drained()) {
+        if (server.slow_peer_policy == tcp_slow_peer_drop) {
+          peer->drained.wait(guard, drained);
+          break;
+        }
+
+        auto stall_time = std::chrono::milliseconds(server.stream_stall_time.load());
+
+        if (peer->drained.wait_until(guard, peer->send_progress + stall_time, drained)) {
+          break;
+        }
+
+        // The socket is only reported writable once a good part of its buffer is free, which can take longer than the
+        // stall time for a peer that keeps reading, so it is offered the queue before the peer counts as stalled
+        flush();
+
+        if (!drained() && std::chrono::steady_clock::now() - peer->send_progress >= stall_time) {
+          logger::it->warn("TCP server: peer is not taking streamed message type {}, closing.", type);
+          peer->failed = true;
+          server.send_stats.evicted_peers.fetch_add(1, std::memory_order_relaxed);
+          server.peer_schedule(peer);
+        }
+      }
+
+      return !peer->failed;
+    }
+
+    bool end() override {
+      TcpSendTimer timer(record, streaming ? 0 : buffered.size());
+
+      if (!streaming) {
+        return server.peer_respond(peer, type, request_id, buffered);
+      }
+
+      std::lock_guard<std::mutex> guard(peer->mutex);
+      return server.peer_send(*peer, 4, request_id, std::vector<uint8_t>(), peer->request_ids);
+    }
+
+  private:
+    // Called with the peer locked, hands the peer to the reactor if its socket interest may have changed
+    void flush() {
+      bool was_blocked = peer->write_blocked;
+      bool was_paused = peer->send_paused;
+
+      if (!server.peer_flush(*peer)) {
+        peer->failed = true;
+      }
+
+      if (was_blocked != peer->write_blocked || was_paused != peer->send_paused || peer->failed) {
+        server.peer_schedule(peer);
+      }
+    }
+
+    ActualTcpServer& server;
+    const std::shared_ptr<TcpPeer>& peer;
+    uint32_t request_id;
+    TcpDispatchRecord& record;
+    uint16_t type = 0;
+    bool streaming = false;
+    std::vector<uint8_t> buffered;
+    std::vector<uint8_t> compressed;
+  };
+
+  class ChannelStream : public TcpMessageStream {
+  public:
+    ChannelStream(ActualTcpServer& server, SharedChannel& channel, bool streaming, TcpDispatchRecord& record)
+        : server(server), channel(channel), streaming(streaming), record(record) {
+
+    }
+
+    bool begin(uint16_t type) override {
+      this->type = type;
+
+      if (streaming) {
+        TcpSendTimer timer(record, 0);
+        std::vector<uint8_t> message(2);
+        *(uint16_t*) &message[0] = type;
+
+        return server.channel_send(channel, 3, message);
+      }
+
+      buffered.clear();
+      return true;
+    }
+
+    bool append(const std::vector<uint8_t>& chunk) override {
+      if (!streaming) {
+        buffered.insert(buffered.end(), chunk.begin(), chunk.end());
+        return true;
+      }
+
+      TcpSendTimer timer(record, chunk.size());
+      return chunk.empty() || server.channel_send(channel, 4, chunk);
+    }
+
+    bool end() override {
+      TcpSendTimer timer(record, streaming ? 0 : buffered.size());
+      return server.channel_send(channel, streaming ? 4 : type, streaming ? std::vector<uint8_t>() : buffered);
+    }
+
+  private:
+    ActualTcpServer& server;
+    SharedChannel& channel;
+    uint16_t type = 0;
+    bool streaming;
+    TcpDispatchRecord& record;
+    std::vector<uint8_t> buffered;
+  };
+
+  // Metrics stay with the message type when its handler is replaced
+  void set_handler(uint16_t type, TcpHandlerEntry entry) {
+    std::lock_guard<std::mutex> guard(metrics_mutex);
+
+    const TcpHandlerEntry* existing = handlers.find(type);
+    entry.metrics = existing != nullptr ? existing->metrics : &metrics.emplace_back(type);
+
+    handlers.set(type, std::move(entry));
+  }
+
   bool try_start_thread(std::function<void(void)>&& function) {
     thread_count++;
 
@@ -74,291 +489,988 @@ private:
     }
   }
 
-  bool try_start_thread_lock(std::function<void(void)>&& function) {
-    std::lock_guard<std::mutex> guard(mutex);
-    return try_start_thread(std::move(function));
-  }
-
   void end_thread() {
     std::lock_guard<std::mutex> guard(mutex);
     thread_count--;
     condition.notify_all();
   }
 
-  void accept_handler() {
-    uint32_t handle = UINT32_MAX;
-    void* accept_event = nullptr;
+  void reactor_handler() {
+    socket_handle listener = invalid_socket_handle;
+
+#ifdef _WIN32
+    SetThreadDescription(GetCurrentThread(), L"TCP server reactor thread");
+#endif
 
-    SetThreadDescription(GetCurrentThread(), L"TCP server accept thread");
+    OnLeave exit([this, &listener] {
+      logger::it->debug("TCP server: reactor thread shutting down.");
 
-    OnLeave exit([this, &handle, &accept_event] {
-      logger::it->debug("TCP server: accept thread shutting down.");
+      for (const auto& it : peers) {
+        std::lock_guard<std::mutex> guard(it.second->mutex);
+        it.second->failed = true;
+        peer_release_queue(*it.second);
+        it.second->drained.notify_all();
 
-      if (handle != UINT32_MAX) {
-        closesocket(handle);
+        reactor->unwatch(it.first);
+        socket_close(it.first);
       }
 
-      if (accept_event != nullptr) {
-        WSACloseEvent(accept_event);
+      peers.clear();
+
+      if (listener != invalid_socket_handle) {
+        reactor->unwatch(listener);
+        socket_close(listener);
       }
 
       end_thread();
     });
 
     logger::it->debug("TCP server: creating listen socket.");
-    handle = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, 0);
+    listener = socket_listen(port);
+
+    if (listener == invalid_socket_handle) {
+      logger::it->error("TCP server: failed to set up listen socket.");
+      return;
+    } else if (!reactor->watch(listener, nullptr, true)) {
+      logger::it->error("TCP server: failed to watch listen socket.");
+      return;
+    }
 
-    if (handle == UINT32_MAX) {
-      WSADATA startup_data;
-      WSAStartup(MAKEWORD(2,2), &startup_data);
+    std::vector<ReactorEvent> events;
+    std::vector<std::shared_ptr<TcpPeer>> scheduled;
+    auto next_metrics_dump = std::chrono::steady_clock::now() + tcp_metrics_interval;
+    auto next_stall_check = std::chrono::steady_clock::now() + tcp_send_stall_timeout;
 
-      handle = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, 0);
+    logger::it->debug("TCP server: beginning reactor loop.");
 
-      if (handle == UINT32_MAX) {
-        logger::it->debug("TCP server: failed to create listen socket.");
+    while (!stopping) {
+      if (!reactor->wait(events, 30000)) {
+        logger::it->error("TCP server: reactor wait failed, aborting.");
         return;
       }
+
+      {
+        std::lock_guard<std::mutex> guard(pending_mutex);
+        scheduled.swap(pending);
+      }
+
+      if (std::chrono::steady_clock::now() >= next_metrics_dump) {
+        next_metrics_dump += tcp_metrics_interval;
+        dump_metrics();
+      }
+
+      if (std::chrono::steady_clock::now() >= next_stall_check) {
+        next_stall_check = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        evict_stalled_peers();
+      }
+
+      if (events.empty() && scheduled.empty()) {
+        logger::it->debug("TCP server: reactor thread still alive.");
+        continue;
+      }
+
+      for (const ReactorEvent& event : events) {
+        if (event.context != nullptr) {
+          peer_event(*(TcpPeer*) event.context, event);
+        } else if (event.closed) {
+          logger::it->error("TCP server: accept socket closed, aborting.");
+          return;
+        } else {
+          accept_peers(listener);
+        }
+      }
+
+      for (const auto& peer : scheduled) {
+        {
+          std::lock_guard<std::mutex> guard(peer->mutex);
+          peer->scheduled = false;
+        }
+
+        peer_service(*peer);
+      }
+
+      scheduled.clear();
+      release_failed_peers();
     }
 
-    if (!socket_configure(handle)) {
-      logger::it->debug("TCP server: failed to set listen socket to non-blocking.");
-      return;
+    logger::it->debug("TCP server: reactor thread stopping as requested.");
+  }
+
+  // Serves one client at a time, running its handlers in order on this thread. Message 12 only accepts streaming,
+  // as there are no request IDs and compression would not pay off without a socket in between.
+  void channel_handler(SharedChannel& channel) {
+#ifdef _WIN32
+    SetThreadDescription(GetCurrentThread(), L"TCP server shared memory thread");
+#endif
+
+    OnLeave exit([this] {
+      logger::it->debug("TCP server: shared memory thread shutting down.");
+      end_thread();
+    });
+
+    // Options negotiated with message 12, which only last for one client session
+    struct ChannelSession {
+      bool streaming = false;
+    } session;
+
+    while (!stopping) {
+      SharedChannelAccept accepted = channel.accept();
+
+      if (accepted == shared_channel_waiting) {
+        continue;
+      } else if (accepted == shared_channel_started) {
+        session = ChannelSession();
+      }
+
+      uint8_t header[6];
+
+      if (!channel.receive(header, sizeof(header))) {
+        continue;
+      }
+
+      uint16_t type = *(uint16_t*) &header[0];
+      uint32_t length = *(uint32_t*) &header[2];
+
+      if (length > tcp_message_length_limit) {
+        logger::it->error("TCP server: shared memory message length too high, dropping client.");
+        channel.reject();
+        continue;
+      }
+
+      std::vector<uint8_t> message(length);
+
+      if (!channel.receive(message.data(), length)) {
+        continue;
+      }
+
+      if (type == 12) {
+        uint32_t requested = length >= 4 ? *(uint32_t*) &message[0] : 0;
+        session.streaming = (requested & tcp_option_streaming) != 0;
+
+        std::vector<uint8_t> response(4);
+        *(uint32_t*) &response[0] = session.streaming ? tcp_option_streaming : 0;
+
+        channel_send(channel, 13, response);
+        continue;
+      }
+
+      TcpDispatchRecord record;
+
+      TcpMessageSender sender = [this, &channel, &record] (uint16_t type, const std::vector<uint8_t>& response) -> bool {
+        TcpSendTimer timer(record, response.size());
+        return channel_send(channel, type, response);
+      };
+
+      const TcpHandlerEntry* entry = handlers.find(type);
+      auto start = std::chrono::steady_clock::now();
+      bool failed = false;
+
+      try {
+        if (entry == nullptr || entry->peer_handler) {
+          std::vector<uint8_t> unknown_response(2);
+          *(uint16_t*) &unknown_response[0] = type;
+
+          sender(1, unknown_response);
+        } else if (entry->stream_handler) {
+          ChannelStream stream(*this, channel, session.streaming, record);
+          entry->stream_handler(type, message, stream);
+        } else {
+          entry->handler(type, message, sender);
+        }
+      } catch (const std::exception& error) {
+        logger::it->error("TCP server: handler for message type {} failed: {}", type, error.what());
+        channel.reject();
+        failed = true;
+      }
+
+      record_dispatch(entry != nullptr ? *entry->metrics : *unknown_metrics, message.size(), record, start, failed);
     }
+  }
 
-    sockaddr_in bind_address{};
-    bind_address.sin_family = AF_INET,
-    bind_address.sin_port = htons(port),
-    bind_address.sin_addr.s_addr = INADDR_ANY;
+  bool channel_send(SharedChannel& channel, uint16_t type, const std::vector<uint8_t>& message) {
+    uint8_t header[6];
+    *(uint16_t*) &header[0] = type;
+    *(uint32_t*) &header[2] = message.size();
 
-    if (bind(handle, (sockaddr*) &bind_address, sizeof(bind_address)) == SOCKET_ERROR) {
-      logger::it->debug("TCP server: failed to bind listen socket.");
-      return;
+    return channel.send(header, sizeof(header)) && channel.send(message.data(), message.size());
+  }
+
+  void accept_peers(socket_handle listener) {
+    while (true) {
+      socket_handle handle = socket_accept(listener);
+
+      if (handle == invalid_socket_handle) {
+        return;
+      }
+
+      logger::it->debug("TCP server: accepting a new connection.");
+
+      auto peer = std::make_shared<TcpPeer>(handle);
+
+      if (!reactor->watch(handle, peer.get(), false)) {
+        logger::it->error("TCP server: failed to watch peer socket.");
+        socket_close(handle);
+        continue;
+      }
+
+      peers[handle] = std::move(peer);
     }
+  }
 
-    if (listen(handle, SOMAXCONN) == SOCKET_ERROR) {
-      logger::it->debug("TCP server: failed to listen on listen socket.");
-      return;
+  void release_failed_peers() {
+    for (auto it = peers.begin(); it != peers.end();) {
+      TcpPeer& peer = *it->second;
+      std::unique_lock<std::mutex> guard(peer.mutex);
+
+      if (peer.failed) {
+        logger::it->debug("TCP server: closing peer.");
+
+        reactor->unwatch(it->first);
+        socket_close(it->first);
+        peer.handle = invalid_socket_handle;
+        peer_release_queue(peer);
+        peer.drained.notify_all();
+
+        guard.unlock();
+        it = peers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Closes peers which have had output queued without the socket taking any of it for too long. Their handlers may be
+  // waiting for the queue to drain, and the queued responses would otherwise stay in memory until they disconnect.
+  void evict_stalled_peers() {
+    auto now = std::chrono::steady_clock::now();
+
+    for (const auto& it : peers) {
+      TcpPeer& peer = *it.second;
+      std::lock_guard<std::mutex> guard(peer.mutex);
+
+      if (!peer.failed && !peer.outbound.empty() && now - peer.send_progress >= tcp_send_stall_timeout) {
+        logger::it->warn("TCP server: peer has not read anything with {} bytes queued, closing.", peer.outbound_bytes);
+
+        peer.failed = true;
+        send_stats.evicted_peers.fetch_add(1, std::memory_order_relaxed);
+        peer_schedule(it.second);
+      }
     }
+  }
 
-    accept_event = WSACreateEvent();
+  void peer_release_queue(TcpPeer& peer) {
+    send_stats.queued_bytes.fetch_sub(peer.outbound_bytes, std::memory_order_relaxed);
 
-    if (accept_event == WSA_INVALID_EVENT) {
-      logger::it->error("TCP server: failed to create accept event object.");
-      return;
-    } else if (WSAEventSelect(handle, accept_event, FD_ACCEPT | FD_CLOSE) == SOCKET_ERROR) {
-      logger::it->error("TCP server: failed to configure accept event object.");
+    peer.outbound.clear();
+    peer.outbound_bytes = 0;
+    peer.outbound_sent = 0;
+  }
+
+  // Hands a peer back to the reactor thread, which re-evaluates its socket interest and closes it if it failed
+  void peer_schedule(const std::shared_ptr<TcpPeer>& peer) {
+    if (!peer->scheduled) {
+      peer->scheduled = true;
+
+      {
+        std::lock_guard<std::mutex> guard(pending_mutex);
+        pending.push_back(peer);
+      }
+
+      reactor->wake();
+    }
+  }
+
+  void peer_event(TcpPeer& peer, const ReactorEvent& event) {
+    if (event.writable) {
+      std::lock_guard<std::mutex> guard(peer.mutex);
+
+      if (!peer.failed && !peer_flush(peer)) {
+        peer.failed = true;
+      }
+    }
+
+    peer_service(peer);
+
+    if (event.closed) {
+      std::lock_guard<std::mutex> guard(peer.mutex);
+
+      if (!peer.failed) {
+        logger::it->warn("TCP server: detected socket close.");
+        peer.failed = true;
+      }
+    }
+  }
+
+  void peer_service(TcpPeer& peer) {
+    if (!peer_receive(peer)) {
+      std::lock_guard<std::mutex> guard(peer.mutex);
+      peer.failed = true;
       return;
     }
 
-    void* events[2] = { stop_event, accept_event };
+    bool read;
+    bool write;
 
-    logger::it->debug("TCP server: beginning accept loop.");
+    {
+      std::lock_guard<std::mutex> guard(peer.mutex);
+
+      if (peer.failed) {
+        return;
+      } else if (peer.read_closed && peer.in_flight == 0 && peer.outbound.empty()) {
+        logger::it->debug("TCP server: peer shut down and has been answered, closing.");
+        peer.failed = true;
+        return;
+      }
+
+      read = peer_can_read(peer);
+      write = peer.write_blocked;
+
+      if (!peer.draining && !peer.send_paused && !peer.inbox.empty()) {
+        peer_start_drain(peers[peer.handle]);
+      }
+    }
+
+    if (read != peer.read_interest || write != peer.write_interest) {
+      peer.read_interest = read;
+      peer.write_interest = write;
+      reactor->interest(peer.handle, read, write);
+    }
+  }
+
+  bool peer_can_read(TcpPeer& peer) {
+    if (peer.request_ids && !peer.switching) {
+      peer.header_length = 10;
+    }
+
+    return !peer.failed && !peer.read_closed && !peer.switching && !peer.send_paused &&
+        peer.in_flight < tcp_peer_request_limit;
+  }
+
+  // Reads as much as the socket has into the receive buffer and accepts every complete message in it before reading
+  // again, so pipelined small messages take one recv between them.
+  bool peer_receive(TcpPeer& peer) {
+    if (peer.receive_buffer.empty()) {
+      peer.receive_buffer.resize(tcp_receive_buffer_size);
+    }
 
     while (true) {
-      uint32_t result = WSAWaitForMultipleEvents(2, events, false, 30000, false);
+      {
+        std::lock_guard<std::mutex> guard(peer.mutex);
 
-      if (result == WSA_WAIT_TIMEOUT) {
-        logger::it->debug("TCP server: accept thread still alive.");
+        if (!peer_can_read(peer)) {
+          return true;
+        }
+      }
+
+      if (peer.receiving_body && peer.body_received == peer.body.size()) {
+        peer.receiving_body = false;
+        peer_accept_message(peer, peer.body_type, peer.body_request_id, std::move(peer.body));
         continue;
-      } else if (result == WSA_WAIT_EVENT_0) {
-        logger::it->debug("TCP server: accept thread stopping as requested.");
-        return;
-      } else if (result == WSA_WAIT_FAILED) {
-        logger::it->error("TCP server: accept wait failed, aborting.");
-        return;
       }
 
-      WSANETWORKEVENTS fired_events;
+      bool parsed;
 
-      if (WSAEnumNetworkEvents(handle, accept_event, &fired_events) == SOCKET_ERROR) {
-        logger::it->error("TCP server: accept event enumeration failed, aborting.");
-        return;
-      } else if ((fired_events.lNetworkEvents & FD_CLOSE) != 0) {
-        logger::it->error("TCP server: accept socket closed, aborting.");
-        return;
-      } else if ((fired_events.lNetworkEvents & FD_ACCEPT) != 0) {
-        uint32_t peer = WSAAccept(handle, nullptr, nullptr, nullptr, 0);
+      if (!peer.receiving_body && !peer_parse_message(peer, parsed)) {
+        return false;
+      } else if (!peer.receiving_body && parsed) {
+        continue;
+      }
 
-        if (peer != UINT32_MAX) {
-          logger::it->debug("TCP server: accepting a new connection.");
+      uint8_t* target;
+      size_t remaining;
 
-          if (!try_start_thread_lock(std::bind(&ActualTcpServer::peer_handler, this, peer))) {
-            logger::it->error("TCP server: failed to create peer socket thread.");
-            closesocket(peer);
-          }
-        } else {
-          logger::it->warn("TCP server: did not find anything to accept.");
+      if (peer.receiving_body) {
+        target = &peer.body[peer.body_received];
+        remaining = peer.body.size() - peer.body_received;
+      } else {
+        if (peer.receive_start > 0) {
+          std::memmove(peer.receive_buffer.data(), &peer.receive_buffer[peer.receive_start],
+                       peer.receive_end - peer.receive_start);
+
+          peer.receive_end -= peer.receive_start;
+          peer.receive_start = 0;
         }
+
+        target = &peer.receive_buffer[peer.receive_end];
+        remaining = peer.receive_buffer.size() - peer.receive_end;
+      }
+
+      size_t received = 0;
+      SocketStatus status = socket_receive(peer.handle, target, remaining, received);
+
+      if (status == SocketStatus::would_block) {
+        return true;
+      } else if (status == SocketStatus::closed) {
+        logger::it->debug("TCP server: on peer read, detected shutdown via recv.");
+
+        std::lock_guard<std::mutex> guard(peer.mutex);
+        peer.read_closed = true;
+        return true;
+      } else if (status == SocketStatus::failed) {
+        logger::it->debug("TCP server: on peer read, recv failed.");
+        return false;
+      }
+
+      if (peer.receiving_body) {
+        peer.body_received += received;
+      } else {
+        peer.receive_end += received;
       }
     }
   }
 
-  void peer_handler(uint32_t peer) {
-    void* io_event = nullptr;
+  // Accepts the next message if the receive buffer holds all of it. A message too large for the buffer takes what has
+  // arrived of its body along and continues receiving into the body itself.
+  bool peer_parse_message(TcpPeer& peer, bool& parsed) {
+    const uint8_t* data = &peer.receive_buffer[peer.receive_start];
+    size_t available = peer.receive_end - peer.receive_start;
 
-    SetThreadDescription(GetCurrentThread(), L"TCP server peer thread");
+    parsed = false;
 
-    OnLeave exit([this, peer, &io_event] {
-      logger::it->debug("TCP server: peer thread shutting down.");
+    if (available < peer.header_length) {
+      return true;
+    }
 
-      if (io_event != nullptr) {
-        WSACloseEvent(io_event);
-      }
+    uint16_t message_type = *(uint16_t*) &data[0];
+    uint32_t message_length = *(uint32_t*) &data[2];
+    uint32_t request_id = peer.header_length > 6 ? *(uint32_t*) &data[6] : 0;
 
-      closesocket(peer);
-      end_thread();
-    });
+    if (message_length > tcp_message_length_limit) {
+      logger::it->error("TCP server: message length too high, aborting connection.");
+      return false;
+    }
 
-    if (!socket_configure(peer)) {
-      logger::it->debug("TCP server: failed to set peer socket to non-blocking.");
-      return;
+    const uint8_t* body = data + peer.header_length;
+    size_t body_available = available - peer.header_length;
+
+    if (body_available >= message_length) {
+      logger::it->debug("TCP server: received message: type {}, length {}.", message_type, message_length);
+
+      peer.receive_start += peer.header_length + message_length;
+      peer_accept_message(peer, message_type, request_id, receive_pool.acquire(body, message_length));
+    } else if (peer.header_length + message_length > peer.receive_buffer.size()) {
+      logger::it->debug("TCP server: receiving large message: type {}, length {}.", message_type, message_length);
+
+      peer.body.resize(message_length);
+      std::memcpy(peer.body.data(), body, body_available);
+
+      peer.body_type = message_type;
+      peer.body_request_id = request_id;
+      peer.body_received = body_available;
+      peer.receiving_body = true;
+      peer.receive_start = 0;
+      peer.receive_end = 0;
+    } else {
+      return true;
     }
 
-    io_event = WSACreateEvent();
+    parsed = true;
+    return true;
+  }
 
-    WSAEventSelect(peer, io_event, FD_READ | FD_WRITE | FD_CLOSE);
+  // Requests without an ID are queued and answered in order by one worker at a time, requests with an ID each get
+  // their own worker job.
+  void peer_accept_message(TcpPeer& peer, uint16_t type, uint32_t request_id, std::vector<uint8_t>&& body) {
+    TcpInboundMessage message { type, request_id, std::move(body) };
 
-    std::vector<uint8_t> header;
-    header.resize(6);
+    std::shared_ptr<TcpPeer> shared = peers[peer.handle];
+    std::lock_guard<std::mutex> guard(peer.mutex);
 
-    bool success = true;
+    peer.in_flight++;
 
-    TcpMessageSender sender = [this, peer, io_event, &header, &success] (uint16_t type, const std::vector<uint8_t>& message) -> bool {
-      logger::it->debug("TCP server: sending response message: type {}, length {}.", type, message.size());
+    if (message.type == 12) {
+      // Framing may change with the answer, so nothing more is read until it has been sent
+      peer.switching = true;
+    }
 
-      *(uint16_t*) &header[0] = type;
-      *(uint32_t*) &header[2] = message.size();
+    if (peer.request_ids && !peer.switching) {
+      auto job_message = std::make_shared<TcpInboundMessage>(std::move(message));
 
-      success = peer_write(peer, io_event, header) && peer_write(peer, io_event, message);
-      return success;
-    };
+      workers->submit([this, shared, job_message] {
+        peer_dispatch(shared, *job_message);
+        peer_complete(shared, false);
+        receive_pool.release(std::move(job_message->body));
+      });
+    } else {
+      peer.inbox.push_back(std::move(message));
+      peer_start_drain(shared);
+    }
+  }
 
-    std::vector<uint8_t> unknown_response;
-    std::vector<uint8_t> message_body;
+  void peer_start_drain(const std::shared_ptr<TcpPeer>& peer) {
+    if (!peer->draining && !peer->send_paused && !peer->inbox.empty()) {
+      peer->draining = true;
 
-    while (peer_read(peer, io_event, header)) {
-      uint16_t message_type = *(uint16_t*) &header[0];
-      uint32_t message_length = *(uint32_t*) &header[2];
+      workers->submit([this, peer] {
+        peer_drain(peer);
+      });
+    }
+  }
 
-      logger::it->debug("TCP server: received message header: type {}, length {}.", message_type, message_length);
+  // Stops while the send queue is paused, the reactor starts draining again once it is back under the low watermark
+  void peer_drain(const std::shared_ptr<TcpPeer>& peer) {
+    while (true) {
+      TcpInboundMessage message;
 
-      if (message_length > 0x100000) {
-        logger::it->error("TCP server: message length too high, aborting connection.");
-        return;
+      {
+        std::lock_guard<std::mutex> guard(peer->mutex);
+
+        if (peer->inbox.empty() || peer->failed || peer->send_paused) {
+          peer->draining = false;
+          return;
+        }
+
+        message = std::move(peer->inbox.front());
+        peer->inbox.pop_front();
       }
 
-      message_body.resize(message_length);
+      if (message.type == 12) {
+        peer_options(peer, message);
+      } else {
+        peer_dispatch(peer, message);
+      }
 
-      if (!peer_read(peer, io_event, message_body)) {
-        logger::it->debug("TCP server: message body not read, closing peer.");
-        return;
+      peer_complete(peer, true);
+      receive_pool.release(std::move(message.body));
+    }
+  }
+
+  void peer_complete(const std::shared_ptr<TcpPeer>& peer, bool coalesce) {
+    std::lock_guard<std::mutex> guard(peer->mutex);
+
+    bool was_limited = peer->in_flight-- == tcp_peer_request_limit;
+    bool was_blocked = peer->write_blocked;
+    bool was_paused = peer->send_paused;
+
+    if (!peer->failed && (!coalesce || peer->inbox.empty() || peer->outbound_bytes >= coalescing_limit)) {
+      if (!peer_flush(*peer)) {
+        peer->failed = true;
       }
+    }
+
+    if (was_limited || was_blocked != peer->write_blocked || was_paused != peer->send_paused || peer->failed ||
+        (peer->read_closed && peer->in_flight == 0)) {
+      peer_schedule(peer);
+    }
+  }
+
+  void peer_options(const std::shared_ptr<TcpPeer>& peer, const TcpInboundMessage& message) {
+    uint32_t requested = message.body.size() >= 4 ? *(uint32_t*) &message.body[0] : 0;
+
+    std::lock_guard<std::mutex> guard(peer->mutex);
+    bool framed = peer->request_ids;
+
+    // Switching back to plain framing with responses still in flight would make them unreadable
+    peer->request_ids = framed || (requested & tcp_option_request_ids) != 0;
+    peer->streaming = (requested & tcp_option_streaming) != 0;
+    peer->compression = (requested & tcp_option_compression) != 0;
+
+    std::vector<uint8_t> response(4);
+    *(uint32_t*) &response[0] = (peer->request_ids ? tcp_option_request_ids : 0) |
+        (peer->streaming ? tcp_option_streaming : 0) | (peer->compression ? tcp_option_compression : 0);
+
+    logger::it->debug("TCP server: peer requested options {:x}, accepted {:x}.", requested, *(uint32_t*) &response[0]);
+
+    peer_send(*peer, 13, message.request_id, response, framed);
+    peer->switching = false;
+    peer_schedule(peer);
+  }
+
+  void peer_dispatch(const std::shared_ptr<TcpPeer>& peer, const TcpInboundMessage& message) {
+    TcpDispatchRecord record;
 
-      TcpMessageHandler* handler;
+    TcpMessageSender sender = [this, &peer, &message, &record] (uint16_t type,
+                                                                const std::vector<uint8_t>& response) -> bool {
+      logger::it->debug("TCP server: sending response message: type {}, length {}.", type, response.size());
 
-      auto it = handlers.find(message_type);
+      TcpSendTimer timer(record, response.size());
+      return peer_respond(peer, type, message.request_id, response);
+    };
+
+    const TcpHandlerEntry* entry = handlers.find(message.type);
+    auto start = std::chrono::steady_clock::now();
+    bool failed = false;
 
-      if (it == handlers.end()) {
-        unknown_response.resize(2);
-        *(uint16_t*) &unknown_response[0] = message_type;
+    try {
+      if (entry == nullptr) {
+        std::vector<uint8_t> unknown_response(2);
+        *(uint16_t*) &unknown_response[0] = message.type;
 
         sender(1, unknown_response);
+      } else if (entry->peer_handler) {
+        entry->peer_handler(peer, message, sender);
+      } else if (entry->stream_handler) {
+        PeerStream stream(*this, peer, message.request_id, record);
+        entry->stream_handler(message.type, message.body, stream);
       } else {
-        it->second(message_type, message_body, sender);
+        entry->handler(message.type, message.body, sender);
       }
+    } catch (const std::exception& error) {
+      logger::it->error("TCP server: handler for message type {} failed: {}", message.type, error.what());
+      failed = true;
 
-      if (!success) {
-        logger::it->debug("TCP server: message sending not performed, closing peer.");
-        return;
+      std::lock_guard<std::mutex> guard(peer->mutex);
+      peer->failed = true;
+    }
+
+    record_dispatch(entry != nullptr ? *entry->metrics : *unknown_metrics, message.body.size(), record, start, failed);
+  }
+
+  void record_dispatch(TcpTypeMetrics& type_metrics, size_t bytes_in, const TcpDispatchRecord& record,
+                       std::chrono::steady_clock::time_point start, bool failed) {
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    type_metrics.handler_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    type_metrics.bytes_in.record(bytes_in);
+    type_metrics.bytes_out.record(record.bytes_out);
+    type_metrics.send_wait.record(record.send_wait);
+
+    if (failed) {
+      type_metrics.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Message 23: uint32_t count, then for every type handled so far uint16_t type, uint64_t errors and for handler
+  // time, bytes in, bytes out and send wait each uint64_t count, sum, p50, p99, p999 and max.
+  void message_metrics(uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+    std::vector<uint8_t> response(4);
+    uint32_t count = 0;
+
+    auto append = [&response] (uint64_t value) {
+      response.insert(response.end(), (uint8_t*) &value, (uint8_t*) &value + sizeof(value));
+    };
+
+    {
+      std::lock_guard<std::mutex> guard(metrics_mutex);
+
+      for (const TcpTypeMetrics& type_metrics : metrics) {
+        if (type_metrics.handler_time.count() == 0) {
+          continue;
+        }
+
+        response.insert(response.end(), (uint8_t*) &type_metrics.type, (uint8_t*) &type_metrics.type + 2);
+        append(type_metrics.errors.load(std::memory_order_relaxed));
+
+        for (const Histogram* histogram : { &type_metrics.handler_time, &type_metrics.bytes_in,
+                                            &type_metrics.bytes_out, &type_metrics.send_wait }) {
+          append(histogram->count());
+          append(histogram->value_sum());
+          append(histogram->percentile(0.5));
+          append(histogram->percentile(0.99));
+          append(histogram->percentile(0.999));
+          append(histogram->max());
+        }
+
+        count++;
       }
     }
 
-    logger::it->debug("TCP server: message header not read, closing peer.");
+    *(uint32_t*) &response[0] = count;
+    sender(23, response);
   }
 
-  bool socket_configure(uint32_t handle) {
-    u_long non_blocking = 1;
-    return ioctlsocket(handle, FIONBIO, &non_blocking) != SOCKET_ERROR;
+  void dump_metrics() {
+    std::lock_guard<std::mutex> guard(metrics_mutex);
+
+    for (const TcpTypeMetrics& type_metrics : metrics) {
+      const Histogram& time = type_metrics.handler_time;
+
+      if (time.count() == 0) {
+        continue;
+      }
+
+      logger::it->info("TCP server: type {}: {} handled, {} failed, time p50 {}us p99 {}us p999 {}us max {}us, "
+                       "in {} B, out {} B, send wait p99 {}us.", type_metrics.type, time.count(),
+                       type_metrics.errors.load(std::memory_order_relaxed), time.percentile(0.5) / 1000,
+                       time.percentile(0.99) / 1000, time.percentile(0.999) / 1000, time.max() / 1000,
+                       type_metrics.bytes_in.value_sum(), type_metrics.bytes_out.value_sum(),
+                       type_metrics.send_wait.percentile(0.99) / 1000);
+    }
+
+    logger::it->info("TCP server: send queues: {} B queued, peak {} B, {} pauses, {} pushes dropped, {} peers evicted.",
+                     send_stats.queued_bytes.load(std::memory_order_relaxed),
+                     send_stats.peak_bytes.load(std::memory_order_relaxed),
+                     send_stats.pauses.load(std::memory_order_relaxed),
+                     send_stats.dropped_pushes.load(std::memory_order_relaxed),
+                     send_stats.evicted_peers.load(std::memory_order_relaxed));
   }
 
-  bool network_wait(uint32_t peer, void* io_event) {
-    void* events[] = { stop_event, io_event };
-    uint32_t result = WSAWaitForMultipleEvents(2, events, false, WSA_INFINITE, false);
+  // Message 25: uint64_t bytes currently queued, peak bytes queued for one peer, times reading was paused, pushes
+  // dropped and peers evicted.
+  void message_send_queue_stats(uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+    std::vector<uint8_t> response;
 
-    if (result == WSA_WAIT_EVENT_0) {
-      logger::it->debug("TCP server: on network wait, detected stop instruction.");
-      return false;
-    } else if (result == WSA_WAIT_FAILED) {
-      logger::it->error("TCP server: on network wait, received wait failure.");
-      return false;
+    for (const std::atomic<uint64_t>* counter : { &send_stats.queued_bytes, &send_stats.peak_bytes, &send_stats.pauses,
+                                                  &send_stats.dropped_pushes, &send_stats.evicted_peers }) {
+      uint64_t value = counter->load(std::memory_order_relaxed);
+      response.insert(response.end(), (uint8_t*) &value, (uint8_t*) &value + sizeof(value));
     }
 
-    WSANETWORKEVENTS fired_events;
+    sender(25, response);
+  }
 
-    if (WSAEnumNetworkEvents(peer, io_event, &fired_events) == SOCKET_ERROR) {
-      logger::it->error("TCP server: on network wait, failed to enumerate events.");
-      return false;
-    } else if ((fired_events.lNetworkEvents & FD_CLOSE) != 0) {
-      logger::it->warn("TCP server: on network wait, detected socket close.");
-      return false;
+  void peer_subscribe(const std::shared_ptr<TcpPeer>& peer, const TcpInboundMessage& message,
+                      const TcpMessageSender& sender) {
+
+    if (message.body.size() != 3) {
+      sender(2, std::vector<uint8_t>());
+      return;
     }
 
-    return true;
+    uint16_t type = *(uint16_t*) &message.body[0];
+    bool enabled = message.body[2] != 0;
+
+    {
+      std::lock_guard<std::mutex> guard(subscriptions_mutex);
+      auto& subscribers = subscriptions[type];
+
+      subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [&peer] (const auto& subscriber) {
+        auto current = subscriber.lock();
+        return current == nullptr || current == peer;
+      }), subscribers.end());
+
+      if (enabled) {
+        subscribers.push_back(peer);
+      }
+    }
+
+    logger::it->debug("TCP server: peer {} message type {}.", enabled ? "subscribed to" : "unsubscribed from", type);
+
+    sender(17, message.body);
   }
 
-  bool peer_read(uint32_t peer, void* io_event, std::vector<uint8_t>& buffer) {
-    size_t total_received = 0;
+  bool peer_respond(const std::shared_ptr<TcpPeer>& peer, uint16_t type, uint32_t request_id,
+                    const std::vector<uint8_t>& message) {
 
-    while (total_received < buffer.size()) {
-      int32_t received = recv(peer, (char*) &buffer[total_received], buffer.size() - total_received, 0);
+    std::vector<uint8_t> compressed;
+    const std::vector<uint8_t>& frame = peer_compress(*peer, type, message, compressed);
 
-      if (received == 0) {
-        logger::it->debug("TCP server: on peer read, detected close via recv.");
-        return false;
-      } else if (received == SOCKET_ERROR) {
-        int32_t last_error = WSAGetLastError();
+    std::lock_guard<std::mutex> guard(peer->mutex);
+    return peer_send(*peer, type, request_id, frame, peer->request_ids);
+  }
 
-        if (last_error == WSAEWOULDBLOCK) {
-          if (!network_wait(peer, io_event)) {
-            return false;
-          }
-        }
-      } else {
-        total_received += received;
+  // With compression negotiated, larger messages are replaced by a type 9 message holding the original type and length
+  // followed by the compressed body, unless compressing did not make it smaller. Runs without holding the peer lock.
+  const std::vector<uint8_t>& peer_compress(TcpPeer& peer, uint16_t& type, const std::vector<uint8_t>& message,
+                                            std::vector<uint8_t>& storage) {
+
+    if (message.size() < tcp_compression_threshold) {
+      return message;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(peer.mutex);
+
+      if (!peer.compression) {
+        return message;
       }
     }
 
+    auto start = std::chrono::steady_clock::now();
+
+    storage.resize(6);
+    *(uint16_t*) &storage[0] = type;
+    *(uint32_t*) &storage[2] = message.size();
+    lz_compress(message.data(), message.size(), storage);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    {
+      std::lock_guard<std::mutex> guard(stats_mutex);
+
+      TcpCompressionStats& stats = compression_stats[type];
+      stats.messages++;
+      stats.original_bytes += message.size();
+      stats.compressed_bytes += std::min(storage.size(), message.size());
+      stats.nanoseconds += elapsed.count();
+    }
+
+    if (storage.size() >= message.size()) {
+      return message;
+    }
+
+    type = 9;
+    return storage;
+  }
+
+  void message_compression_stats(uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+    std::vector<uint8_t> response;
+
+    {
+      std::lock_guard<std::mutex> guard(stats_mutex);
+
+      uint32_t count = compression_stats.size();
+      response.insert(response.end(), (uint8_t*) &count, (uint8_t*) &count + sizeof(count));
+
+      for (const auto& it : compression_stats) {
+        const TcpCompressionStats& stats = it.second;
+        response.insert(response.end(), (uint8_t*) &it.first, (uint8_t*) &it.first + sizeof(it.first));
+        response.insert(response.end(), (uint8_t*) &stats.messages, (uint8_t*) &stats.messages + sizeof(stats.messages));
+        response.insert(response.end(), (uint8_t*) &stats.original_bytes, (uint8_t*) &stats.original_bytes + sizeof(stats.original_bytes));
+        response.insert(response.end(), (uint8_t*) &stats.compressed_bytes, (uint8_t*) &stats.compressed_bytes + sizeof(stats.compressed_bytes));
+        response.insert(response.end(), (uint8_t*) &stats.nanoseconds, (uint8_t*) &stats.nanoseconds + sizeof(stats.nanoseconds));
+      }
+    }
+
+    sender(15, response);
+  }
+
+  // A shared message is queued as is if the socket does not take it right away, otherwise the message is copied
+  bool peer_send(TcpPeer& peer, uint16_t type, uint32_t request_id, const std::vector<uint8_t>& message,
+                 bool request_ids, const std::shared_ptr<const std::vector<uint8_t>>& shared = nullptr) {
+
+    if (peer.failed) {
+      return false;
+    }
+
+    TcpOutboundFrame frame;
+    frame.header_length = request_ids ? 10 : 6;
+    *(uint16_t*) &frame.header[0] = type;
+    *(uint32_t*) &frame.header[2] = message.size();
+    *(uint32_t*) &frame.header[6] = request_id;
+
+    size_t sent = 0;
+
+    // Without anything queued, write straight from the handler's buffer and only copy what the socket did not take
+    if (peer.outbound.empty() && !peer.write_blocked &&
+        (request_ids || coalescing_limit == 0 || peer.inbox.empty())) {
+
+      SocketBuffer buffers[] = {
+          { frame.header, frame.header_length },
+          { message.data(), message.size() }
+      };
+
+      SocketStatus status = socket_send_vectored(peer.handle, buffers, 2, sent);
+
+      if (status == SocketStatus::failed || status == SocketStatus::closed) {
+        logger::it->debug("TCP server: on peer write, send failed.");
+        peer.failed = true;
+        return false;
+      } else if (sent == frame.header_length + message.size()) {
+        return true;
+      }
+    }
+
+    if (peer.outbound.empty()) {
+      peer.outbound_sent = sent;
+      peer.send_progress = std::chrono::steady_clock::now();
+    }
+
+    size_t queued = frame.header_length + message.size() - sent;
+    peer.outbound_bytes += queued;
+    send_stats.queued_bytes.fetch_add(queued, std::memory_order_relaxed);
+
+    uint64_t peak = send_stats.peak_bytes.load(std::memory_order_relaxed);
+
+    while (peer.outbound_bytes > peak &&
+           !send_stats.peak_bytes.compare_exchange_weak(peak, peer.outbound_bytes, std::memory_order_relaxed)) {
+    }
+
+    if (!peer.send_paused && peer.outbound_bytes >= send_high_watermark) {
+      peer.send_paused = true;
+      send_stats.pauses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    frame.body = shared != nullptr ? shared : std::make_shared<const std::vector<uint8_t>>(message);
+    peer.outbound.push_back(std::move(frame));
     return true;
   }
 
-  bool peer_write(uint32_t peer, void* io_event, const std::vector<uint8_t>& buffer) {
-    size_t total_sent = 0;
+  bool peer_flush(TcpPeer& peer) {
+    SocketBuffer buffers[64];
+
+    while (!peer.outbound.empty()) {
+      size_t count = 0;
+      size_t offset = peer.outbound_sent;
 
-    while (total_sent < buffer.size()) {
-      int32_t sent = send(peer, (const char*) &buffer[total_sent], buffer.size() - total_sent, 0);
+      for (const auto& frame : peer.outbound) {
+        if (count + 2 > sizeof(buffers) / sizeof(buffers[0])) {
+          break;
+        }
+
+        if (offset < frame.header_length) {
+          buffers[count++] = { &frame.header[offset], frame.header_length - offset };
+        }
 
-      if (sent == SOCKET_ERROR) {
-        int32_t last_error = WSAGetLastError();
+        size_t body_offset = offset > frame.header_length ? offset - frame.header_length : 0;
 
-        if (last_error == WSAEWOULDBLOCK) {
-          if (!network_wait(peer, io_event)) {
-            return false;
-          }
+        if (body_offset < frame.body->size()) {
+          buffers[count++] = { frame.body->data() + body_offset, frame.body->size() - body_offset };
         }
-      } else {
-        total_sent += sent;
+
+        offset = 0;
+      }
+
+      size_t sent = 0;
+      SocketStatus status = socket_send_vectored(peer.handle, buffers, count, sent);
+
+      if (status == SocketStatus::would_block) {
+        peer.write_blocked = true;
+        return true;
+      } else if (status != SocketStatus::done) {
+        logger::it->debug("TCP server: on peer write, send failed.");
+        return false;
       }
+
+      peer_consume(peer, sent);
     }
 
+    peer.write_blocked = false;
     return true;
   }
 
+  void peer_consume(TcpPeer& peer, size_t sent) {
+    peer.outbound_bytes -= sent;
+    peer.send_progress = std::chrono::steady_clock::now();
+    send_stats.queued_bytes.fetch_sub(sent, std::memory_order_relaxed);
+
+    if (peer.send_paused && peer.outbound_bytes <= send_low_watermark) {
+      peer.send_paused = false;
+    }
+
+    peer.drained.notify_all();
+
+    while (sent > 0) {
+      const auto& frame = peer.outbound.front();
+      size_t remaining = frame.header_length + frame.body->size() - peer.outbound_sent;
+
+      if (sent < remaining) {
+        peer.outbound_sent += sent;
+        return;
+      }
+
+      sent -= remaining;
+      peer.outbound_sent = 0;
+      peer.outbound.pop_front();
+    }
+  }
+
   std::mutex mutex;
   std::condition_variable condition;
   bool started = false;
+  std::atomic<bool> stopping { false };
+  std::atomic<uint32_t> coalescing_limit { 0x10000 };
+  std::atomic<uint32_t> send_low_watermark { 0x40000 };
+  std::atomic<uint32_t> send_high_watermark { 0x100000 };
+  std::atomic<TcpSlowPeerPolicy> slow_peer_policy { tcp_slow_peer_disconnect };
+  std::atomic<uint32_t> stream_stall_time { 1000 };
+  TcpSendQueueStats send_stats;
   uint32_t thread_count = 0;
-  void* stop_event;
-  std::unordered_map<uint16_t, TcpMessageHandler> handlers;
+  std::unique_ptr<Reactor> reactor;
+  std::unique_ptr<WorkerPool> workers;
+  std::unordered_map<socket_handle, std::shared_ptr<TcpPeer>> peers;
+  std::mutex pending_mutex;
+  std::vector<std::shared_ptr<TcpPeer>> pending;
+  DispatchTable<TcpHandlerEntry> handlers;
+  BufferPool receive_pool;
+  std::mutex metrics_mutex;
+  std::deque<TcpTypeMetrics> metrics;
+  TcpTypeMetrics* unknown_metrics;
+  std::mutex subscriptions_mutex;
+  std::unordered_map<uint16_t, std::vector<std::weak_ptr<TcpPeer>>> subscriptions;
+  std::mutex stats_mutex;
+  std::unordered_map<uint16_t, TcpCompressionStats> compression_stats;
   int port;
 };
 
@@ -2,14 +2,67 @@
 
 #include <stdint.h>
 #include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 typedef std::function<bool(uint16_t, const std::vector<uint8_t>&)> TcpMessageSender;
 typedef std::function<void(uint16_t, const std::vector<uint8_t>&, const TcpMessageSender&)> TcpMessageHandler;
 
+// Builds one response message from consecutive chunks. With streaming negotiated, begin() sends a type 3 frame with
+// the response type, every append() a type 4 frame with the chunk and end() an empty type 4 frame. Otherwise the chunks
+// are collected and sent as one message on end(). Handlers run on one of 4 worker threads, and a streaming append()
+// holds its worker while the peer is over the send high watermark, see set_send_limits for how long. append() returns
+// false once the peer has been disconnected.
+class TcpMessageStream {
+public:
+  virtual ~TcpMessageStream() = default;
+  virtual bool begin(uint16_t type) = 0;
+  virtual bool append(const std::vector<uint8_t>& chunk) = 0;
+  virtual bool end() = 0;
+};
+
+typedef std::function<void(uint16_t, const std::vector<uint8_t>&, TcpMessageStream&)> TcpStreamHandler;
+
+// Flags requested with message type 12 and acknowledged with type 13. Once request IDs are accepted, both directions
+// append a uint32_t request ID to the 6-byte header, handlers run concurrently and responses may arrive out of order.
+// With compression, responses of 256 bytes or more may arrive as type 9: uint16_t original type, uint32_t original
+// length and the body as an LZ4 block. Message type 14 returns per-type compression statistics as type 15.
+// Message type 16 (uint16_t type, uint8_t enabled) subscribes to or unsubscribes from published messages of that type
+// and is echoed back as type 17.
+// Message type 22 returns per-type counters and latency percentiles as type 23, which are also logged every minute.
+// Message type 24 returns send queue counters as type 25.
+enum TcpProtocolOption : uint32_t {
+  tcp_option_request_ids = 0x01,
+  tcp_option_streaming = 0x02,
+  tcp_option_compression = 0x04
+};
+
+// What happens to a published message for a peer whose send queue is above the high watermark. Under either policy, a
+// peer which has not taken any queued bytes for 10 seconds is disconnected.
+enum TcpSlowPeerPolicy : uint32_t {
+  tcp_slow_peer_disconnect,
+  tcp_slow_peer_drop
+};
+
 class TcpServer {
 public:
   virtual ~TcpServer() = default;
   virtual void add_handler(uint16_t type, TcpMessageHandler handler) = 0;
+  virtual void add_stream_handler(uint16_t type, TcpStreamHandler handler) = 0;
+  // Responses to pipelined messages are gathered into one send up to this many bytes, 0 sends each one right away
+  virtual void set_coalescing_limit(uint32_t bytes) = 0;
+  // Above the high watermark of queued bytes, requests are no longer read from the peer until its queue is back down
+  // to the low watermark. A streamed response going over the high watermark waits in append() until the queue is back
+  // down to the low watermark. Under the disconnect policy, a peer which takes none of its queued bytes for
+  // stream_stall_ms during that wait is disconnected. Under the drop policy the wait lasts until the queue drains or
+  // the 10 second stall check disconnects the peer. Defaults are 256 KiB, 1 MiB, disconnect and 1000 ms.
+  virtual void set_send_limits(uint32_t low_watermark, uint32_t high_watermark, TcpSlowPeerPolicy policy,
+                               uint32_t stream_stall_ms) = 0;
+  // Pushes the message to all subscribers of its type with request ID 0, they all share the same buffer
+  virtual void publish(uint16_t type, std::shared_ptr<const std::vector<uint8_t>> message) = 0;
+  // Serves the same messages to one local client at a time through a shared memory region, see shared_channel.h
+  virtual void serve_shared_memory(const std::string& name, uint32_t capacity) = 0;
   virtual void start() = 0;
 };
 
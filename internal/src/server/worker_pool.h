@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t thread_count) {
+    for (size_t i = 0; i < thread_count; i++) {
+      threads.emplace_back(&WorkerPool::worker, this);
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopping = true;
+    }
+
+    condition.notify_all();
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      jobs.push_back(std::move(job));
+    }
+
+    condition.notify_one();
+  }
+
+private:
+  void worker() {
+    while (true) {
+      std::function<void()> job;
+
+      {
+        std::unique_lock<std::mutex> guard(mutex);
+        condition.wait(guard, [this] { return stopping || !jobs.empty(); });
+
+        if (stopping) {
+          return;
+        }
+
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+
+      job();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> threads;
+  bool stopping = false;
+};
@@ -0,0 +1,102 @@
+#include "utf8.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_SSE2
+#include <emmintrin.h>
+#endif
+
+static char* utf8_write(char* output, uint32_t code_point) {
+  if (code_point < 0x80) {
+    *output++ = (char) code_point;
+  } else if (code_point < 0x800) {
+    *output++ = (char) (0xC0 | (code_point >> 6));
+    *output++ = (char) (0x80 | (code_point & 0x3F));
+  } else if (code_point < 0x10000) {
+    *output++ = (char) (0xE0 | (code_point >> 12));
+    *output++ = (char) (0x80 | ((code_point >> 6) & 0x3F));
+    *output++ = (char) (0x80 | (code_point & 0x3F));
+  } else {
+    *output++ = (char) (0xF0 | (code_point >> 18));
+    *output++ = (char) (0x80 | ((code_point >> 12) & 0x3F));
+    *output++ = (char) (0x80 | ((code_point >> 6) & 0x3F));
+    *output++ = (char) (0x80 | (code_point & 0x3F));
+  }
+
+  return output;
+}
+
+#ifdef UTF8_SSE2
+// Writes the next 8 units as bytes if they are all ASCII
+template <typename Unit>
+static bool utf8_ascii_block(const Unit* input, char* output) {
+  __m128i packed;
+
+  if constexpr (sizeof(Unit) == 2) {
+    packed = _mm_loadu_si128((const __m128i*) input);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(packed, _mm_set1_epi16((short) 0xFF80)),
+                                          _mm_setzero_si128())) != 0xFFFF) {
+      return false;
+    }
+  } else {
+    __m128i low = _mm_loadu_si128((const __m128i*) input);
+    __m128i high = _mm_loadu_si128((const __m128i*) (input + 4));
+    __m128i ascii = _mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(low, high), _mm_set1_epi32((int) 0xFFFFFF80)),
+                                    _mm_setzero_si128());
+
+    if (_mm_movemask_epi8(ascii) != 0xFFFF) {
+      return false;
+    }
+
+    packed = _mm_packs_epi32(low, high);
+  }
+
+  _mm_storel_epi64((__m128i*) output, _mm_packus_epi16(packed, packed));
+  return true;
+}
+#endif
+
+template <typename Unit>
+static size_t utf8_convert(const Unit* input, size_t length, char* output) {
+  char* start = output;
+  size_t i = 0;
+
+  while (i < length) {
+#ifdef UTF8_SSE2
+    if (i + 8 <= length && utf8_ascii_block(input + i, output)) {
+      i += 8;
+      output += 8;
+      continue;
+    }
+#endif
+
+    auto unit = (uint32_t) input[i++];
+
+    if constexpr (sizeof(Unit) == 2) {
+      if (unit >= 0xD800 && unit <= 0xDFFF) {
+        auto next = i < length ? (uint32_t) input[i] : 0;
+
+        if (unit <= 0xDBFF && next >= 0xDC00 && next <= 0xDFFF) {
+          unit = 0x10000 + ((unit - 0xD800) << 10) + (next - 0xDC00);
+          i++;
+        } else {
+          unit = 0xFFFD;
+        }
+      }
+    } else if (unit > 0x10FFFF || (unit >= 0xD800 && unit <= 0xDFFF)) {
+      unit = 0xFFFD;
+    }
+
+    output = utf8_write(output, unit);
+  }
+
+  return output - start;
+}
+
+size_t utf8_from_utf16(const char16_t* input, size_t length, char* output) {
+  return utf8_convert(input, length, output);
+}
+
+size_t utf8_from_wide(const wchar_t* input, size_t length, char* output) {
+  return utf8_convert(input, length, output);
+}
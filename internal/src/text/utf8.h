@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Converts UTF-16 to UTF-8 into a caller provided buffer of at least utf8_length_bound bytes and returns the number of
+// bytes written. Runs of ASCII are converted 8 units at a time with SSE2 where available. Unpaired surrogates become
+// U+FFFD. With a 32-bit wchar_t, wide strings are taken as UTF-32 instead.
+size_t utf8_from_utf16(const char16_t* input, size_t length, char* output);
+size_t utf8_from_wide(const wchar_t* input, size_t length, char* output);
+
+constexpr size_t utf8_length_bound(size_t units, size_t unit_size) {
+  return units * (unit_size == 2 ? 3 : 4);
+}
+
+inline void utf8_append(std::string& output, const wchar_t* input, size_t length) {
+  size_t offset = output.size();
+  output.resize(offset + utf8_length_bound(length, sizeof(wchar_t)));
+  output.resize(offset + utf8_from_wide(input, length, &output[offset]));
+}
+
+inline void utf8_append(std::vector<uint8_t>& output, const wchar_t* input, size_t length) {
+  size_t offset = output.size();
+  output.resize(offset + utf8_length_bound(length, sizeof(wchar_t)));
+  output.resize(offset + utf8_from_wide(input, length, reinterpret_cast<char*>(output.data() + offset)));
+}
@@ -0,0 +1,160 @@
+#include "server/tcp_server.h"
+#include "server/dispatch_table.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+
+// Looks up message types the way the TCP server dispatches them, once in the server's DispatchTable and once in a
+// std::unordered_map keyed by type as a lock-free alternative would be, after checking that both find the same entry
+// for every 16-bit type.
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOptions {
+  uint32_t lookups = 65536;
+  uint32_t iterations = 200;
+};
+
+// Laid out like the server's TcpHandlerEntry, whose peer handler type is private to the server
+struct BenchEntry {
+  TcpMessageHandler handler;
+  TcpStreamHandler stream_handler;
+  std::function<void()> peer_handler;
+  uint32_t* metrics;
+};
+
+// Every type the DLL and the server register, with how often each is requested relative to the others. The weights
+// of 5, 7 and 10 follow the default load mix, the rest are occasional.
+struct BenchType {
+  uint16_t type;
+  uint32_t weight;
+};
+
+static const BenchType bench_types[] = {
+  { 5, 8 }, { 7, 64 }, { 10, 64 }, { 14, 1 }, { 16, 1 }, { 20, 4 }, { 22, 1 }, { 24, 1 }, { 26, 1 }, { 28, 8 },
+  { 30, 2 }, { 32, 4 }, { 36, 1 }, { 40, 4 }
+};
+
+template <typename Find>
+static double bench_lookups(const std::vector<uint16_t>& types, uint32_t iterations, Find find) {
+  auto start = bench_clock::now();
+  uint64_t found = 0;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (uint16_t type : types) {
+      const BenchEntry* entry = find(type);
+      found += entry != nullptr ? *entry->metrics : 0;
+    }
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+
+  if (found == 0) {
+    fprintf(stderr, "Nothing was found.\n");
+  }
+
+  return (double) elapsed.count() / ((double) iterations * types.size());
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    uint32_t value;
+
+    try {
+      value = (uint32_t) std::max(1ul, std::stoul(argv[i + 1]));
+    } catch (const std::exception& error) {
+      return false;
+    }
+
+    if (name == "--lookups") {
+      options.lookups = value;
+    } else if (name == "--iterations") {
+      options.iterations = value;
+    } else {
+      return false;
+    }
+  }
+
+  return argc % 2 == 1;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    fprintf(stderr, "Usage: dispatch_bench [--lookups N] [--iterations N]\n");
+    return 1;
+  }
+
+  const size_t type_count = sizeof(bench_types) / sizeof(bench_types[0]);
+  std::vector<uint32_t> metrics(type_count, 1);
+  DispatchTable<BenchEntry> table;
+  std::unordered_map<uint16_t, BenchEntry> map;
+
+  auto handler = [] (uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+
+  };
+
+  for (size_t i = 0; i < type_count; i++) {
+    BenchEntry entry { handler, nullptr, nullptr, &metrics[i] };
+
+    table.set(bench_types[i].type, entry);
+    map.emplace(bench_types[i].type, entry);
+  }
+
+  auto find_table = [&table] (uint16_t type) {
+    return table.find(type);
+  };
+
+  auto find_map = [&map] (uint16_t type) -> const BenchEntry* {
+    auto it = map.find(type);
+    return it != map.end() ? &it->second : nullptr;
+  };
+
+  for (uint32_t type = 0; type <= 0xFFFF; type++) {
+    const BenchEntry* from_table = find_table((uint16_t) type);
+    const BenchEntry* from_map = find_map((uint16_t) type);
+
+    if ((from_table == nullptr) != (from_map == nullptr) ||
+        (from_table != nullptr && from_table->metrics != from_map->metrics)) {
+      fprintf(stderr, "Dispatch table and map disagree on message type %u.\n", type);
+      return 1;
+    }
+  }
+
+  // Requests for registered types in proportion to their weights, and the same with one in 16 of an unknown type
+  std::mt19937 random(1234);
+  std::vector<uint16_t> weighted;
+
+  for (const BenchType& type : bench_types) {
+    weighted.insert(weighted.end(), type.weight, type.type);
+  }
+
+  std::uniform_int_distribution<size_t> pick(0, weighted.size() - 1);
+  std::uniform_int_distribution<uint32_t> any_type(0, 0xFFFF);
+  std::vector<uint16_t> known_types;
+  std::vector<uint16_t> mixed_types;
+
+  for (uint32_t i = 0; i < options.lookups; i++) {
+    known_types.push_back(weighted[pick(random)]);
+    mixed_types.push_back(i % 16 == 0 ? (uint16_t) any_type(random) : known_types.back());
+  }
+
+  printf("%zu handler types, %u lookups, %u iterations\n", type_count, options.lookups, options.iterations);
+  printf("types    lookup           ns/lookup\n");
+
+  for (auto* types : { &known_types, &mixed_types }) {
+    const char* label = types == &known_types ? "known" : "mixed";
+
+    printf("%-8s %-10s %15.2f\n", label, "table", bench_lookups(*types, options.iterations, find_table));
+    printf("%-8s %-10s %15.2f\n", label, "map", bench_lookups(*types, options.iterations, find_map));
+  }
+
+  return 0;
+}
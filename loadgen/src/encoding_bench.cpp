@@ -0,0 +1,667 @@
+#include "emitter_encoding.h"
+#include "emitter_snapshot.h"
+#include "emitter_override.h"
+#include "emitter_edit.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+
+// Encodes emitter details the way message type 7 answers, once with the per-field append path which the handler first
+// used, once with the encoder generated from the emitter schema, and checks that both produce the same bytes. Also
+// takes columnar snapshots of all emitters like message type 30 and checks that each emitter reads back the same, and
+// fingerprints them like the frame loop does for message type 34, checking that only the content decides the result.
+// Overrides like message type 36 are checked with a parser which copies a generated emitter instead of the engine's,
+// and edits like message type 40 by writing every field of one emitter into another. Emitters with long curves, which
+// used to be more than the details message could hold, are encoded separately.
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOptions {
+  uint32_t emitters = 256;
+  uint32_t items = 8;
+  uint32_t long_items = 512;
+  uint32_t iterations = 200;
+};
+
+struct BenchEmitter {
+  WRenderParticleEmitter emitter;
+  std::vector<float> floats;
+  std::vector<WXVector2> vectors2;
+  std::vector<WXVector3> vectors3;
+};
+
+template <typename T>
+static void append_buffer(std::vector<uint8_t>& response, const WXBuffer<T>& buffer,
+                          std::function<void(std::vector<uint8_t>&, const T&)> item_encoder) {
+
+  message_append(response, buffer.length);
+
+  for (size_t i = 0; i < buffer.length; i++) {
+    item_encoder(response, buffer.data[i]);
+  }
+}
+
+static void append_float(std::vector<uint8_t>& response, const float& value) {
+  message_append(response, value);
+}
+
+static void append_buffer(std::vector<uint8_t>& response, const WXBuffer<float>& buffer) {
+  append_buffer<float>(response, buffer, append_float);
+}
+
+static void append_vector3(std::vector<uint8_t>& response, const WXVector3& value) {
+  message_append(response, value.x);
+  message_append(response, value.y);
+  message_append(response, value.z);
+}
+
+static void append_buffer(std::vector<uint8_t>& response, const WXBuffer<WXVector3>& buffer) {
+  append_buffer<WXVector3>(response, buffer, append_vector3);
+}
+
+static void append_vector2(std::vector<uint8_t>& response, const WXVector2& value) {
+  message_append(response, value.x);
+  message_append(response, value.y);
+}
+
+static void append_buffer(std::vector<uint8_t>& response, const WXBuffer<WXVector2>& buffer) {
+  append_buffer<WXVector2>(response, buffer, append_vector2);
+}
+
+static void append_emitter_data(std::vector<uint8_t>& response, const WRenderParticleEmitter& emitter) {
+  message_append(response, emitter.initializer_bitset);
+  message_append(response, emitter.modificator_bitset);
+
+  const WXParticleEmitterModuleData& data = emitter.emitter_data;
+  append_buffer(response, data.alpha);
+  append_buffer(response, data.color);
+  append_buffer(response, data.lifetime);
+  append_buffer(response, data.position);
+  append_float(response, data.position_offset);
+  append_buffer(response, data.rotation);
+  append_buffer(response, data.rotation_3d);
+  append_buffer(response, data.rotation_rate);
+  append_buffer(response, data.rotation_rate_3d);
+  append_buffer(response, data.size);
+  append_buffer(response, data.size_3d);
+  message_append(response, data.size_keep_ratio);
+  append_buffer(response, data.spawn_extents);
+  append_buffer(response, data.spawn_inner_radius);
+  append_buffer(response, data.spawn_outer_radius);
+  message_append(response, data.spawn_world_space);
+  message_append(response, data.spawn_surface_only);
+  append_vector3(response, data.p0A8);
+
+  for (float i : data.spawn_to_local_matrix) {
+    append_float(response, i);
+  }
+
+  append_buffer(response, data.velocity);
+  message_append(response, data.velocity_world_space);
+  append_buffer(response, data.velocity_inherit_scale);
+  append_buffer(response, data.velocity_spread_scale);
+  message_append(response, data.velocity_spread_conserve_momentum);
+  append_buffer(response, data.texture_animation_initial_frame);
+  message_append(response, data.p140);
+  message_append(response, data.p144);
+  message_append(response, data.p148);
+
+  append_buffer(response, data.velocity_over_life);
+  append_buffer(response, data.acceleration_direction);
+  append_buffer(response, data.acceleration_scale);
+  append_buffer(response, data.rotation_over_life);
+  append_buffer(response, data.rotation_rate_over_life);
+  append_buffer(response, data.rotation_3d_over_life);
+  append_buffer(response, data.rotation_rate_3d_over_life);
+  append_buffer(response, data.color_over_life);
+  append_buffer(response, data.alpha_over_life);
+  append_buffer(response, data.size_over_life);
+  append_buffer(response, data.size_over_life_orientation);
+  append_buffer(response, data.texture_animation_speed);
+  append_buffer(response, data.velocity_turbulize_scale);
+  append_buffer(response, data.velocity_turbulize_timelife_limit);
+  append_float(response, data.velocity_turbulize_noise_interval);
+  append_float(response, data.velocity_turbulize_duration);
+  append_buffer(response, data.target_force_scale);
+  append_buffer(response, data.target_kill_radius);
+  append_float(response, data.target_max_force);
+  append_buffer(response, data.target_position);
+  message_append(response, data.spawn_positive_x);
+  message_append(response, data.spawn_negative_x);
+  message_append(response, data.spawn_positive_y);
+  message_append(response, data.spawn_negative_y);
+  message_append(response, data.spawn_position_z);
+  message_append(response, data.spawn_negative_z);
+  message_append(response, data.spawn_velocity);
+  message_append(response, data.collision_triggering_group_index);
+  append_float(response, data.collision_dynamic_friction);
+  append_float(response, data.collision_static_friction);
+  append_float(response, data.collision_restitution);
+  append_float(response, data.collision_velocity_dampening);
+  message_append(response, data.collision_disable_gravity);
+  message_append(response, data.collision_use_gpu);
+  append_float(response, data.collision_radius);
+  message_append(response, data.collision_kill_when_collide);
+  message_append(response, data.collision_self_emitter_index);
+  append_float(response, data.collision_spawn_probability);
+  message_append(response, data.collision_spawn_parent_emitter_index);
+  append_float(response, data.alpha_by_distance_far);
+  append_float(response, data.alpha_by_distance_near);
+}
+
+// Every buffer gets between 1 and twice the given number of items, pointing into storage owned by the emitter
+template <typename T>
+static void fill_buffer(WXBuffer<T>& buffer, std::vector<T>& storage, uint32_t length) {
+  buffer.data = storage.data() + storage.size();
+  buffer.length = length;
+  storage.resize(storage.size() + length);
+}
+
+static void generate_emitter(BenchEmitter& bench, uint32_t items, std::mt19937& random) {
+  WXParticleEmitterModuleData& data = bench.emitter.emitter_data;
+  uint32_t longest = std::max(items * 2, 1u);
+  std::uniform_int_distribution<uint32_t> lengths(1, longest);
+  std::uniform_real_distribution<float> values(-100.0f, 100.0f);
+
+  std::memset(&bench.emitter, 0, sizeof(bench.emitter));
+  // The buffers point into the storage, so it must never move: 17 float lists, 2 of WXVector2 and 15 of WXVector3
+  bench.floats.reserve(17 * (size_t) longest);
+  bench.vectors2.reserve(2 * (size_t) longest);
+  bench.vectors3.reserve(15 * (size_t) longest);
+
+  for (WXBuffer<float>* buffer : { &data.alpha, &data.lifetime, &data.rotation, &data.rotation_rate,
+                                   &data.spawn_inner_radius, &data.spawn_outer_radius, &data.velocity_inherit_scale,
+                                   &data.velocity_spread_scale, &data.texture_animation_initial_frame,
+                                   &data.acceleration_scale, &data.rotation_over_life, &data.rotation_rate_over_life,
+                                   &data.alpha_over_life, &data.texture_animation_speed,
+                                   &data.velocity_turbulize_timelife_limit, &data.target_force_scale,
+                                   &data.target_kill_radius }) {
+    fill_buffer(*buffer, bench.floats, lengths(random));
+  }
+
+  for (WXBuffer<WXVector2>* buffer : { &data.size, &data.size_over_life }) {
+    fill_buffer(*buffer, bench.vectors2, lengths(random));
+  }
+
+  for (WXBuffer<WXVector3>* buffer : { &data.color, &data.position, &data.rotation_3d, &data.rotation_rate_3d,
+                                       &data.size_3d, &data.spawn_extents, &data.velocity, &data.velocity_over_life,
+                                       &data.acceleration_direction, &data.rotation_3d_over_life,
+                                       &data.rotation_rate_3d_over_life, &data.color_over_life,
+                                       &data.size_over_life_orientation, &data.velocity_turbulize_scale,
+                                       &data.target_position }) {
+    fill_buffer(*buffer, bench.vectors3, lengths(random));
+  }
+
+  for (float& value : bench.floats) {
+    value = values(random);
+  }
+
+  for (WXVector2& value : bench.vectors2) {
+    value = { values(random), values(random) };
+  }
+
+  for (WXVector3& value : bench.vectors3) {
+    value = { values(random), values(random), values(random) };
+  }
+
+  for (float& value : data.spawn_to_local_matrix) {
+    value = values(random);
+  }
+
+  data.position_offset = values(random);
+  data.collision_radius = values(random);
+  data.collision_triggering_group_index = random();
+  bench.emitter.initializer_bitset = random();
+  bench.emitter.modificator_bitset = random();
+}
+
+// Runs the encoder over all emitters for every iteration and returns nanoseconds per emitter, every response starts
+// out empty like in the handler
+static double bench_encoder(const std::vector<BenchEmitter>& emitters, uint32_t iterations, size_t& total_bytes,
+                            const std::function<void(std::vector<uint8_t>&, const WRenderParticleEmitter&)>& encoder) {
+
+  auto start = bench_clock::now();
+  total_bytes = 0;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (const BenchEmitter& bench : emitters) {
+      std::vector<uint8_t> response;
+      response.push_back(1);
+
+      encoder(response, bench.emitter);
+      total_bytes += response.size();
+    }
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+  return (double) elapsed.count() / ((double) iterations * emitters.size());
+}
+
+static std::vector<uint8_t> take_snapshot(const std::vector<BenchEmitter>& emitters) {
+  EmitterSnapshot snapshot(1, emitters.size());
+  std::vector<uint8_t> result;
+
+  for (size_t i = 0; i < emitters.size(); i++) {
+    snapshot.add(i + 1, emitters[i].emitter);
+  }
+
+  snapshot.write([&result] (const std::vector<uint8_t>& part) {
+    result.insert(result.end(), part.begin(), part.end());
+    return true;
+  });
+
+  return result;
+}
+
+template <class Type>
+static Type snapshot_read(const std::vector<uint8_t>& snapshot, uint64_t offset) {
+  Type value;
+  std::memcpy(&value, &snapshot[offset], sizeof(value));
+  return value;
+}
+
+// Puts the message 8 encoding of one emitter back together from the columns, the way an offline tool would read them
+static bool snapshot_encoding(const std::vector<uint8_t>& snapshot, uint32_t emitter, std::vector<uint8_t>& encoded) {
+  if (snapshot_read<uint32_t>(snapshot, 0) != EmitterSnapshot::magic ||
+      snapshot_read<uint32_t>(snapshot, 20) != EmitterSnapshot::column_count ||
+      snapshot_read<uint64_t>(snapshot, snapshot_read<uint64_t>(snapshot, 24) + emitter * 8) != emitter + 1) {
+    return false;
+  }
+
+  uint32_t count = snapshot_read<uint32_t>(snapshot, 16);
+
+  for (size_t i = 0; i < EmitterSnapshot::column_count; i++) {
+    uint64_t entry = EmitterSnapshot::header_size + i * EmitterSnapshot::column_entry_size;
+    uint32_t item_size = snapshot_read<uint32_t>(snapshot, entry + 4);
+    uint64_t data = snapshot_read<uint64_t>(snapshot, entry + 16);
+    uint64_t index = snapshot_read<uint64_t>(snapshot, entry + 24);
+
+    std::string name((const char*) &snapshot[snapshot_read<uint32_t>(snapshot, entry + 8)],
+                     snapshot_read<uint32_t>(snapshot, entry + 12));
+
+    if (name != emitter_fields[i].name || data % 8 != 0 || index % 8 != 0) {
+      return false;
+    }
+
+    if (index == 0) {
+      message_append(encoded, &snapshot[data + (uint64_t) emitter * item_size], item_size);
+      continue;
+    }
+
+    uint32_t first = snapshot_read<uint32_t>(snapshot, index + emitter * 4);
+    uint32_t last = snapshot_read<uint32_t>(snapshot, index + (emitter + 1) * 4);
+
+    if (last < first || snapshot_read<uint32_t>(snapshot, index + count * 4) * (uint64_t) item_size > snapshot.size()) {
+      return false;
+    }
+
+    uint32_t length = last - first;
+    message_append(encoded, length);
+    message_append(encoded, &snapshot[data + (uint64_t) first * item_size], (size_t) (last - first) * item_size);
+  }
+
+  return true;
+}
+
+// Equal content in separate storage gives equal fingerprints, changing a list item or a scalar gives a different one
+static bool check_fingerprints(uint32_t items) {
+  BenchEmitter first;
+  BenchEmitter second;
+  std::mt19937 first_random(99);
+  std::mt19937 second_random(99);
+
+  generate_emitter(first, items, first_random);
+  generate_emitter(second, items, second_random);
+
+  uint64_t original = emitter_fingerprint(first.emitter);
+
+  if (original == 0 || emitter_fingerprint(second.emitter) != original) {
+    return false;
+  }
+
+  second.vectors3.back().z += 1.0f;
+  uint64_t changed_item = emitter_fingerprint(second.emitter);
+  second.vectors3.back().z -= 1.0f;
+
+  second.emitter.emitter_data.collision_radius += 1.0f;
+  uint64_t changed_scalar = emitter_fingerprint(second.emitter);
+
+  return changed_item != original && changed_scalar != original && changed_item != changed_scalar;
+}
+
+static const WXParticleEmitterModuleData* parser_source = nullptr;
+static uint32_t parser_calls = 0;
+
+// Stands in for the engine parser, the lists of the result point into the storage of the source
+static void copy_parser(WMemoryFileReader* reader, WXParticleEmitterModuleData* data) {
+  *data = *parser_source;
+  parser_calls++;
+}
+
+// Whether the list header covers the byte at the offset in the module data
+static bool in_list_header(size_t offset) {
+  const size_t data_offset = offsetof(WRenderParticleEmitter, emitter_data);
+
+  for (const EmitterField& field : emitter_fields) {
+    if (emitter_field_is_list(field.kind) && offset + data_offset >= field.offset &&
+        offset + data_offset < field.offset + sizeof(WXBuffer<uint8_t>)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Everything the engine parser writes except the list headers, including bytes the schema does not name
+static bool same_module_data(const WXParticleEmitterModuleData& left, const WXParticleEmitterModuleData& right) {
+  auto left_bytes = reinterpret_cast<const uint8_t*>(&left);
+  auto right_bytes = reinterpret_cast<const uint8_t*>(&right);
+
+  for (size_t i = 0; i < sizeof(WXParticleEmitterModuleData); i++) {
+    if (!in_list_header(i) && left_bytes[i] != right_bytes[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// An emitter with lists of the same lengths gets a copy of the image, any other gets parsed. Both end up with the same
+// details as the source. Returns nanoseconds per copy, or a negative value if a check fails.
+static double check_override(const BenchEmitter& other, uint32_t items, uint32_t iterations) {
+  BenchEmitter source;
+  BenchEmitter target;
+  std::mt19937 source_random(7);
+  std::mt19937 target_random(7);
+  std::vector<uint8_t> config(64);
+
+  generate_emitter(source, items, source_random);
+  generate_emitter(target, items, target_random);
+
+  // The config also sets bytes the schema has no name for, like p0B4 and p22C
+  auto source_bytes = reinterpret_cast<uint8_t*>(&source.emitter.emitter_data);
+
+  for (size_t i = 0; i < sizeof(WXParticleEmitterModuleData); i++) {
+    if (!in_list_header(i)) {
+      source_bytes[i] ^= (uint8_t) (i * 0x9D + 1);
+    }
+  }
+
+  for (float& value : target.floats) {
+    value += 1.0f;
+  }
+
+  target.emitter.emitter_data.collision_radius += 1.0f;
+  parser_source = &source.emitter.emitter_data;
+
+  EmitterOverride override(copy_parser, WMemoryFileReader {});
+  override.load(config);
+
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> copied;
+  std::vector<uint8_t> parsed;
+  BenchEmitter mismatched = other;
+
+  message_append_fields(expected, source.emitter);
+  mismatched.emitter.initializer_bitset = source.emitter.initializer_bitset;
+  mismatched.emitter.modificator_bitset = source.emitter.modificator_bitset;
+
+  uint32_t calls = parser_calls;
+  bool copy_applied = override.apply(target.emitter.emitter_data);
+  bool parse_applied = override.apply(mismatched.emitter.emitter_data);
+
+  message_append_fields(copied, target.emitter);
+  message_append_fields(parsed, mismatched.emitter);
+
+  if (!copy_applied || parse_applied || parser_calls != calls + 1 || copied != expected || parsed != expected ||
+      target.floats.data() != target.emitter.emitter_data.alpha.data ||
+      !same_module_data(target.emitter.emitter_data, source.emitter.emitter_data) ||
+      !same_module_data(mismatched.emitter.emitter_data, source.emitter.emitter_data)) {
+    return -1.0;
+  }
+
+  auto start = bench_clock::now();
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    override.apply(target.emitter.emitter_data);
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+  return (double) elapsed.count() / iterations;
+}
+
+// Message type 40 setting every field to the value it has in the emitter
+static std::vector<uint8_t> edit_message(uint64_t handle, const WRenderParticleEmitter& emitter) {
+  auto base = reinterpret_cast<const uint8_t*>(&emitter);
+  auto count = (uint32_t) EmitterSnapshot::column_count;
+  std::vector<uint8_t> message;
+
+  message_append(message, handle);
+  message_append(message, count);
+
+  for (const EmitterField& field : emitter_fields) {
+    auto name_length = (uint8_t) std::strlen(field.name);
+    uint32_t size = emitter_field_size(field.kind);
+
+    message_append(message, name_length);
+    message_append(message, field.name, name_length);
+
+    if (!emitter_field_is_list(field.kind)) {
+      message_append(message, base + field.offset, size);
+      continue;
+    }
+
+    const auto& buffer = *reinterpret_cast<const WXBuffer<uint8_t>*>(base + field.offset);
+    message_append(message, buffer.length);
+    message_append(message, buffer.data, (size_t) buffer.length * size);
+  }
+
+  return message;
+}
+
+// Edits one emitter into another, checks that it ends up with the same details and gets its own lists back when the
+// arena is released. Returns nanoseconds per decoded and applied edit, or a negative value if a check fails.
+static double check_edit(const BenchEmitter& source, BenchEmitter& target, uint32_t iterations) {
+  EmitterArenas arenas;
+  EmitterEdit edit;
+  WRenderParticleEmitter original = target.emitter;
+  std::vector<uint8_t> message = edit_message(1, source.emitter);
+  std::vector<uint8_t> truncated(message.begin(), message.end() - 1);
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> edited;
+
+  if (emitter_edit_decode(truncated, edit) || !emitter_edit_decode(message, edit) || edit.handle != 1) {
+    return -1.0;
+  }
+
+  emitter_edit_apply(edit, target.emitter, arenas);
+
+  message_append_fields(expected, source.emitter);
+  message_append_fields(edited, target.emitter);
+  arenas.release(&target.emitter);
+
+  if (edited != expected) {
+    return -1.0;
+  }
+
+  for (const EmitterField& field : emitter_fields) {
+    if (emitter_field_is_list(field.kind) && std::memcmp(reinterpret_cast<uint8_t*>(&target.emitter) + field.offset,
+                                                         reinterpret_cast<uint8_t*>(&original) + field.offset,
+                                                         sizeof(WXBuffer<uint8_t>)) != 0) {
+      return -1.0;
+    }
+  }
+
+  auto start = bench_clock::now();
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    emitter_edit_decode(message, edit);
+    emitter_edit_apply(edit, target.emitter, arenas);
+    arenas.release(&target.emitter);
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+  return (double) elapsed.count() / iterations;
+}
+
+static bool check_encodings(const std::vector<BenchEmitter>& emitters) {
+  for (const BenchEmitter& bench : emitters) {
+    std::vector<uint8_t> appended;
+    std::vector<uint8_t> written;
+
+    append_emitter_data(appended, bench.emitter);
+    message_append_fields(written, bench.emitter);
+
+    if (appended != written) {
+      fprintf(stderr, "Encodings differ: %zu bytes appended, %zu bytes written.\n", appended.size(), written.size());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    uint32_t value;
+
+    try {
+      value = (uint32_t) std::max(1ul, std::stoul(argv[i + 1]));
+    } catch (const std::exception& error) {
+      return false;
+    }
+
+    if (name == "--emitters") {
+      options.emitters = value;
+    } else if (name == "--items") {
+      options.items = std::min(value, 1u << 20);
+    } else if (name == "--long-items") {
+      options.long_items = std::min(value, 1u << 20);
+    } else if (name == "--iterations") {
+      options.iterations = value;
+    } else {
+      return false;
+    }
+  }
+
+  return argc % 2 == 1;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    fprintf(stderr, "Usage: encoding_bench [--emitters N] [--items N] [--long-items N] [--iterations N]\n");
+    return 1;
+  }
+
+  std::mt19937 random(1234);
+  std::vector<BenchEmitter> emitters(options.emitters);
+  std::vector<BenchEmitter> long_emitters(std::max(options.emitters / 8, 1u));
+
+  for (BenchEmitter& bench : emitters) {
+    generate_emitter(bench, options.items, random);
+  }
+
+  for (BenchEmitter& bench : long_emitters) {
+    generate_emitter(bench, options.long_items, random);
+  }
+
+  if (!check_encodings(emitters) || !check_encodings(long_emitters)) {
+    return 1;
+  }
+
+  std::vector<uint8_t> snapshot = take_snapshot(emitters);
+
+  for (uint32_t i = 0; i < emitters.size(); i++) {
+    std::vector<uint8_t> encoded;
+    std::vector<uint8_t> written;
+
+    message_append_fields(written, emitters[i].emitter);
+
+    if (!snapshot_encoding(snapshot, i, encoded) || encoded != written) {
+      fprintf(stderr, "Snapshot of emitter %u does not read back the same.\n", i);
+      return 1;
+    }
+  }
+
+  if (!check_fingerprints(options.items)) {
+    fprintf(stderr, "Fingerprints do not follow the emitter content.\n");
+    return 1;
+  }
+
+  double override_time = check_override(emitters[0], options.items, options.iterations * options.emitters);
+
+  if (override_time < 0) {
+    fprintf(stderr, "Emitter override does not end up with the parameters of the config.\n");
+    return 1;
+  }
+
+  BenchEmitter edited = emitters[1 % emitters.size()];
+  double edit_time = check_edit(emitters[0], edited, options.iterations * options.emitters / 16 + 1);
+
+  if (edit_time < 0) {
+    fprintf(stderr, "Emitter edit does not end up with the parameters it was sent.\n");
+    return 1;
+  }
+
+  size_t append_bytes = 0;
+  size_t schema_bytes = 0;
+
+  double append_time = bench_encoder(emitters, options.iterations, append_bytes, append_emitter_data);
+  double schema_time = bench_encoder(emitters, options.iterations, schema_bytes,
+                                     message_append_fields<WRenderParticleEmitter>);
+
+  auto snapshot_start = bench_clock::now();
+
+  for (uint32_t i = 0; i < options.iterations; i++) {
+    snapshot = take_snapshot(emitters);
+  }
+
+  auto snapshot_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - snapshot_start);
+  double snapshot_time = (double) snapshot_elapsed.count() / ((double) options.iterations * emitters.size());
+  uint64_t fingerprints = 0;
+  auto fingerprint_start = bench_clock::now();
+
+  for (uint32_t i = 0; i < options.iterations; i++) {
+    for (const BenchEmitter& bench : emitters) {
+      fingerprints ^= emitter_fingerprint(bench.emitter);
+    }
+  }
+
+  auto fingerprint_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - fingerprint_start);
+  double fingerprint_time = (double) fingerprint_elapsed.count() / ((double) options.iterations * emitters.size());
+  double bytes_per_emitter = (double) schema_bytes / ((double) options.iterations * emitters.size());
+  uint32_t long_iterations = std::max(options.iterations / 8, 1u);
+
+  double long_append_time = bench_encoder(long_emitters, long_iterations, append_bytes, append_emitter_data);
+  double long_schema_time = bench_encoder(long_emitters, long_iterations, schema_bytes,
+                                          message_append_fields<WRenderParticleEmitter>);
+
+  double long_bytes_per_emitter = (double) schema_bytes / ((double) long_iterations * long_emitters.size());
+
+  printf("%u emitters, %.0f bytes each, %u iterations\n", options.emitters, bytes_per_emitter, options.iterations);
+  printf("encoder          ns/emitter       MB/s\n");
+  printf("append      %15.1f %10.1f\n", append_time, bytes_per_emitter * 1000.0 / append_time);
+  printf("schema      %15.1f %10.1f\n", schema_time, bytes_per_emitter * 1000.0 / schema_time);
+  printf("snapshot    %15.1f %10.1f\n", snapshot_time, (double) snapshot.size() / emitters.size() * 1000.0 / snapshot_time);
+  printf("fingerprint %15.1f %10.1f\n", fingerprint_time, bytes_per_emitter * 1000.0 / fingerprint_time);
+  printf("override    %15.1f %10.1f\n", override_time, bytes_per_emitter * 1000.0 / override_time);
+  printf("edit        %15.1f %10.1f\n", edit_time, bytes_per_emitter * 1000.0 / edit_time);
+
+  printf("\n%zu emitters with long curves, %.0f bytes each, %u iterations\n", long_emitters.size(),
+         long_bytes_per_emitter, long_iterations);
+  printf("encoder          ns/emitter       MB/s\n");
+  printf("append      %15.1f %10.1f\n", long_append_time, long_bytes_per_emitter * 1000.0 / long_append_time);
+  printf("schema      %15.1f %10.1f\n", long_schema_time, long_bytes_per_emitter * 1000.0 / long_schema_time);
+
+  // Keeps the fingerprint loop from being optimized away
+  return fingerprints == 1 ? 2 : 0;
+}
@@ -0,0 +1,304 @@
+#include "server/tcp_server.h"
+#include "logging/log.h"
+#include "emitter_encoding.h"
+#include "handle_table.h"
+#include "text/utf8.h"
+
+#include <spdlog/sinks/stdout_sinks.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+
+// The server outside of the game: same networking code, but the emitter and bundle handlers answer from generated
+// fixtures with the same message formats, sized like a typical scene.
+namespace logger {
+  std::string wide(const std::wstring& value) {
+    std::string result;
+    utf8_append(result, value.data(), value.length());
+    return result;
+  }
+
+  std::string wide(const wchar_t* value) {
+    std::string result;
+    utf8_append(result, value, wcslen(value));
+    return result;
+  }
+
+  std::shared_ptr<spdlog::logger> it = spdlog::stdout_logger_mt("fixture");
+}
+
+struct FixtureEmitter {
+  uint64_t handle;
+  std::string directory;
+  std::string file;
+  uint32_t file_index;
+  // Encoded with the schema for every message 7 like in the game, the lists point into the items
+  WRenderParticleEmitter render_emitter;
+  std::vector<uint8_t> items;
+};
+
+struct FixtureFile {
+  std::string bundle_path;
+  std::string file_path;
+};
+
+struct Fixtures {
+  std::vector<FixtureEmitter> emitters;
+  // Index into emitters for each handle
+  HandleTable<size_t> emitter_handles;
+  std::vector<FixtureFile> files;
+};
+
+static void append_string(std::vector<uint8_t>& message, const std::string& value) {
+  uint32_t length = value.size();
+
+  message.insert(message.end(), (uint8_t*) &length, (uint8_t*) &length + sizeof(length));
+  message.insert(message.end(), value.begin(), value.end());
+}
+
+// Roughly what a scene's emitters hold: mostly constant curves with now and then a few points, values on a coarse grid,
+// an identity spawn matrix and a handful of flags
+static void fixture_emitter_generate(FixtureEmitter& emitter, std::mt19937& random) {
+  auto base = reinterpret_cast<uint8_t*>(&emitter.render_emitter);
+  std::uniform_int_distribution<int32_t> steps(-64, 64);
+  std::vector<uint32_t> lengths;
+  size_t items_size = 0;
+
+  auto fill = [&random, &steps] (uint8_t* target, size_t floats) {
+    for (size_t i = 0; i < floats; i++) {
+      float value = steps(random) / 16.0f;
+      std::memcpy(target + i * sizeof(float), &value, sizeof(float));
+    }
+  };
+
+  std::memset(base, 0, sizeof(emitter.render_emitter));
+
+  for (const EmitterField& field : emitter_fields) {
+    if (emitter_field_is_list(field.kind)) {
+      lengths.push_back(random() % 4 == 0 ? 2 + random() % 3 : 1);
+      items_size += (size_t) lengths.back() * emitter_field_size(field.kind);
+    }
+  }
+
+  // Sized once, so that the lists can point into it
+  emitter.items.resize(items_size);
+  uint8_t* items = emitter.items.data();
+  size_t list = 0;
+
+  for (const EmitterField& field : emitter_fields) {
+    uint8_t* target = base + field.offset;
+    uint32_t size = emitter_field_size(field.kind);
+
+    if (emitter_field_is_list(field.kind)) {
+      auto& buffer = *reinterpret_cast<WXBuffer<uint8_t>*>(target);
+      buffer.data = items;
+      buffer.length = lengths[list++];
+
+      fill(items, (size_t) buffer.length * size / sizeof(float));
+      items += (size_t) buffer.length * size;
+    } else if (field.kind == emitter_field_float || field.kind == emitter_field_vector3) {
+      fill(target, size / sizeof(float));
+    } else if (field.kind == emitter_field_matrix) {
+      for (size_t i = 0; i < 4; i++) {
+        float one = 1.0f;
+        std::memcpy(target + (i * 4 + i) * sizeof(float), &one, sizeof(float));
+      }
+    } else {
+      uint64_t value = random() & 0x1F;
+      std::memcpy(target, &value, size);
+    }
+  }
+}
+
+static void fixtures_generate(Fixtures& fixtures, uint32_t emitter_count, uint32_t file_count, uint32_t bundle_count) {
+  std::mt19937 random(1);
+  std::vector<std::string> bundles;
+
+  for (uint32_t i = 0; i < bundle_count; i++) {
+    bundles.push_back(fmt::format("C:/Games/Witcher 3/content/content{}/bundles/blob{}.bundle", i % 16, i));
+  }
+
+  fixtures.files.resize(file_count + 1);
+
+  for (uint32_t i = 1; i <= file_count; i++) {
+    fixtures.files[i] = {
+        bundles[random() % bundles.size()],
+        fmt::format("environment/particles/set{}/effect{}/emitter{}.w2p", i % 97, i % 13, i)
+    };
+  }
+
+  for (uint32_t i = 0; i < emitter_count; i++) {
+    FixtureEmitter emitter;
+    emitter.handle = fixtures.emitter_handles.insert(fixtures.emitters.size());
+    emitter.directory = fmt::format("environment/particles/set{}/effect{}/", i % 97, i % 13);
+    emitter.file = fmt::format("emitter{}.w2p", i);
+    emitter.file_index = 1 + random() % file_count;
+    fixture_emitter_generate(emitter, random);
+
+    fixtures.emitters.push_back(std::move(emitter));
+  }
+}
+
+static void fixtures_serve(TcpServer* server, const Fixtures& fixtures) {
+  server->add_stream_handler(5, [&fixtures] (uint16_t type, const std::vector<uint8_t>& message,
+                                             TcpMessageStream& stream) {
+    if (!stream.begin(6)) {
+      return;
+    }
+
+    std::vector<uint8_t> chunk;
+
+    uint32_t size = fixtures.emitters.size();
+    chunk.insert(chunk.end(), (uint8_t*) &size, (uint8_t*) &size + sizeof(size));
+
+    for (const auto& emitter : fixtures.emitters) {
+      chunk.insert(chunk.end(), (uint8_t*) &emitter.handle, (uint8_t*) &emitter.handle + sizeof(emitter.handle));
+      append_string(chunk, emitter.directory);
+      append_string(chunk, emitter.file);
+      append_string(chunk, fixtures.files[emitter.file_index].bundle_path);
+
+      if (chunk.size() >= 0x10000) {
+        if (!stream.append(chunk)) {
+          return;
+        }
+
+        chunk.clear();
+      }
+    }
+
+    if (stream.append(chunk)) {
+      stream.end();
+    }
+  });
+
+  server->add_handler(7, [&fixtures] (uint16_t type, const std::vector<uint8_t>& message,
+                                      const TcpMessageSender& sender) {
+    if (message.size() != sizeof(uint64_t)) {
+      sender(2, std::vector<uint8_t>());
+      return;
+    }
+
+    const size_t* index = fixtures.emitter_handles.find(*(uint64_t*) &message[0]);
+    std::vector<uint8_t> response;
+
+    if (index == nullptr) {
+      response.push_back(0);
+    } else {
+      response.push_back(1);
+      message_append_fields(response, fixtures.emitters[*index].render_emitter);
+    }
+
+    sender(8, response);
+  });
+
+  server->add_handler(26, [] (uint16_t type, const std::vector<uint8_t>& message, const TcpMessageSender& sender) {
+    sender(27, emitter_schema_message());
+  });
+
+  server->add_handler(10, [&fixtures] (uint16_t type, const std::vector<uint8_t>& message,
+                                       const TcpMessageSender& sender) {
+    if (message.size() < 4) {
+      sender(2, std::vector<uint8_t>());
+      return;
+    }
+
+    uint32_t file_index = *(uint32_t*) &message[0];
+    std::vector<uint8_t> response;
+
+    if (file_index > 0 && file_index < fixtures.files.size()) {
+      append_string(response, fixtures.files[file_index].bundle_path);
+      append_string(response, fixtures.files[file_index].file_path);
+    } else {
+      append_string(response, "<not found>");
+      append_string(response, "<not found>");
+    }
+
+    sender(11, response);
+  });
+}
+
+struct FixtureOptions {
+  uint16_t port = 3548;
+  uint32_t emitters = 2000;
+  uint32_t files = 10000;
+  uint32_t bundles = 60;
+  std::string shared_memory;
+};
+
+static void print_usage() {
+  fprintf(stderr,
+      "Usage: loadgen_server [options]\n"
+      "  --port N             port to listen on (3548)\n"
+      "  --emitters N         generated emitters (2000)\n"
+      "  --files N            generated files (10000)\n"
+      "  --bundles N          generated bundles the files are spread over (60)\n"
+      "  --shared-memory NAME also serve the shared memory channel NAME\n");
+}
+
+// Every option takes a value, anything else, including --help, ends up printing the usage
+static bool parse_options(int argc, char** argv, FixtureOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+
+    if (name == "--help" || i + 1 >= argc) {
+      return false;
+    }
+
+    std::string value = argv[++i];
+
+    try {
+      if (name == "--shared-memory") {
+        options.shared_memory = value;
+      } else if (name == "--port") {
+        options.port = (uint16_t) std::stoul(value);
+      } else if (name == "--emitters") {
+        options.emitters = (uint32_t) std::stoul(value);
+      } else if (name == "--files") {
+        options.files = std::max(1u, (uint32_t) std::stoul(value));
+      } else if (name == "--bundles") {
+        options.bundles = std::max(1u, (uint32_t) std::stoul(value));
+      } else {
+        return false;
+      }
+    } catch (const std::exception& error) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv) {
+  FixtureOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    print_usage();
+    return 1;
+  }
+
+  logger::it->set_level(spdlog::level::warn);
+
+  Fixtures fixtures;
+  fixtures_generate(fixtures, options.emitters, options.files, options.bundles);
+
+  std::unique_ptr<TcpServer> server(tcp_server_create(options.port));
+  fixtures_serve(server.get(), fixtures);
+  server->start();
+
+  // A small ring, so that the emitter list alone is larger than it and everything wraps often
+  if (!options.shared_memory.empty()) {
+    server->serve_shared_memory(options.shared_memory, 0x10000);
+  }
+
+  printf("Serving %u emitters and %u files on port %u.\n", options.emitters, options.files, options.port);
+
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
@@ -0,0 +1,1013 @@
+#include "server/compression.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+typedef SOCKET socket_handle;
+static const socket_handle invalid_socket_handle = INVALID_SOCKET;
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+typedef int socket_handle;
+static const socket_handle invalid_socket_handle = -1;
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+
+typedef std::chrono::steady_clock load_clock;
+
+struct LoadOptions {
+  std::string host = "127.0.0.1";
+  std::string port = "3548";
+  uint32_t connections = 4;
+  double rate = 10000;
+  double duration = 10;
+  double warmup = 2;
+  uint32_t file_indices = 10000;
+  bool compression = false;
+  std::vector<std::pair<uint16_t, uint32_t>> mix { { 5, 1 }, { 7, 8 }, { 10, 8 } };
+  std::string csv;
+  std::string shared_memory;
+};
+
+struct LoadRequest {
+  uint16_t type;
+  load_clock::time_point intended;
+};
+
+// Latencies are kept per connection and only merged at the end, so recording never contends
+struct LoadResults {
+  std::unordered_map<uint16_t, std::vector<uint64_t>> latencies;
+  load_clock::time_point last_completion;
+  uint64_t errors = 0;
+};
+
+static void socket_close(socket_handle handle) {
+#ifdef _WIN32
+  closesocket(handle);
+#else
+  close(handle);
+#endif
+}
+
+static socket_handle socket_connect(const LoadOptions& options) {
+  addrinfo hints {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* addresses = nullptr;
+
+  if (getaddrinfo(options.host.c_str(), options.port.c_str(), &hints, &addresses) != 0) {
+    return invalid_socket_handle;
+  }
+
+  socket_handle handle = invalid_socket_handle;
+
+  for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+    handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+    if (handle == invalid_socket_handle) {
+      continue;
+    } else if (connect(handle, address->ai_addr, (int) address->ai_addrlen) == 0) {
+      break;
+    }
+
+    socket_close(handle);
+    handle = invalid_socket_handle;
+  }
+
+  freeaddrinfo(addresses);
+
+  if (handle != invalid_socket_handle) {
+    int enabled = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*) &enabled, sizeof(enabled));
+  }
+
+  return handle;
+}
+
+static bool socket_send_all(socket_handle handle, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    auto sent = send(handle, (const char*) data, (int) length, 0);
+
+    if (sent <= 0) {
+      return false;
+    }
+
+    data += sent;
+    length -= sent;
+  }
+
+  return true;
+}
+
+static bool socket_receive_all(socket_handle handle, uint8_t* data, size_t length) {
+  while (length > 0) {
+    auto received = recv(handle, (char*) data, (int) length, 0);
+
+    if (received <= 0) {
+      return false;
+    }
+
+    data += received;
+    length -= received;
+  }
+
+  return true;
+}
+
+static bool send_message(socket_handle handle, uint16_t type, uint32_t request_id, const std::vector<uint8_t>& body,
+                         bool request_ids) {
+
+  std::vector<uint8_t> message(request_ids ? 10 : 6);
+  *(uint16_t*) &message[0] = type;
+  *(uint32_t*) &message[2] = body.size();
+
+  if (request_ids) {
+    *(uint32_t*) &message[6] = request_id;
+  }
+
+  message.insert(message.end(), body.begin(), body.end());
+  return socket_send_all(handle, message.data(), message.size());
+}
+
+static bool receive_message(socket_handle handle, uint16_t& type, uint32_t& request_id, std::vector<uint8_t>& body,
+                            bool request_ids) {
+
+  uint8_t header[10] {};
+
+  if (!socket_receive_all(handle, header, request_ids ? 10 : 6)) {
+    return false;
+  }
+
+  type = *(uint16_t*) &header[0];
+  request_id = request_ids ? *(uint32_t*) &header[6] : 0;
+  body.resize(*(uint32_t*) &header[2]);
+
+  return socket_receive_all(handle, body.data(), body.size());
+}
+
+// One request on a connection of its own, without negotiating anything
+static bool exchange_message(const LoadOptions& options, uint16_t type, const std::vector<uint8_t>& request,
+                             uint16_t& response_type, std::vector<uint8_t>& response) {
+
+  socket_handle handle = socket_connect(options);
+
+  if (handle == invalid_socket_handle) {
+    return false;
+  }
+
+  uint32_t request_id = 0;
+
+  bool received = send_message(handle, type, 0, request, false) &&
+      receive_message(handle, response_type, request_id, response, false);
+
+  socket_close(handle);
+  return received;
+}
+
+// Type 9 is a compressed response: uint16_t original type, uint32_t original length, then the body as an LZ4 block
+static bool decompress_response(uint16_t& type, std::vector<uint8_t>& body) {
+  if (type != 9) {
+    return true;
+  } else if (body.size() < 6) {
+    return false;
+  }
+
+  uint16_t original_type = *(uint16_t*) &body[0];
+  uint32_t original_length = *(uint32_t*) &body[2];
+  std::vector<uint8_t> original;
+  original.reserve(original_length);
+
+  if (!lz_decompress(&body[6], body.size() - 6, original) || original.size() != original_length) {
+    return false;
+  }
+
+  type = original_type;
+  body = std::move(original);
+  return true;
+}
+
+// Fetches the emitter list once, so that details requests ask for emitters which exist
+static bool load_emitter_handles(const LoadOptions& options, std::vector<uint64_t>& handles) {
+  uint16_t type = 0;
+  std::vector<uint8_t> body;
+
+  if (!exchange_message(options, 5, std::vector<uint8_t>(), type, body) || type != 6 || body.size() < 4) {
+    return false;
+  }
+
+  uint32_t count = *(uint32_t*) &body[0];
+  size_t offset = 4;
+
+  for (uint32_t i = 0; i < count; i++) {
+    // Handle, then directory, file and bundle, only the handle is kept
+    if (offset + 8 > body.size()) {
+      return false;
+    }
+
+    handles.push_back(*(uint64_t*) &body[offset]);
+    offset += 8;
+
+    for (uint32_t field = 0; field < 3; field++) {
+      if (offset + 4 > body.size()) {
+        return false;
+      }
+
+      uint32_t length = *(uint32_t*) &body[offset];
+
+      if (offset + 4 + length > body.size()) {
+        return false;
+      }
+
+      offset += 4 + length;
+    }
+  }
+
+  return true;
+}
+
+class LoadConnection {
+public:
+  LoadConnection(const LoadOptions& options, const std::vector<uint64_t>& handles, uint32_t seed)
+      : options(options), handles(handles), random(seed) {
+
+    uint32_t total = 0;
+
+    for (const auto& entry : options.mix) {
+      total += entry.second;
+      weights.push_back(total);
+    }
+  }
+
+  bool run(load_clock::time_point start, load_clock::time_point measure_from, load_clock::time_point end) {
+    handle = socket_connect(options);
+
+    if (handle == invalid_socket_handle) {
+      fprintf(stderr, "Failed to connect to %s:%s.\n", options.host.c_str(), options.port.c_str());
+      return false;
+    } else if (!negotiate()) {
+      fprintf(stderr, "Failed to negotiate request IDs.\n");
+      socket_close(handle);
+      return false;
+    }
+
+    std::thread receiver(&LoadConnection::receive_loop, this, measure_from);
+    send_loop(start, end);
+
+    // Give outstanding responses a moment before cutting the connection
+    auto deadline = load_clock::now() + std::chrono::seconds(2);
+
+    while (load_clock::now() < deadline) {
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        if (pending.empty()) {
+          break;
+        }
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    finished = true;
+#ifdef _WIN32
+    shutdown(handle, SD_BOTH);
+#else
+    shutdown(handle, SHUT_RDWR);
+#endif
+    receiver.join();
+    socket_close(handle);
+
+    results.errors += pending.size();
+    return true;
+  }
+
+  LoadResults results;
+
+private:
+  bool negotiate() {
+    uint32_t requested = 0x01 | (options.compression ? 0x04 : 0);
+    std::vector<uint8_t> body(4);
+    *(uint32_t*) &body[0] = requested;
+
+    uint16_t type = 0;
+    uint32_t request_id = 0;
+
+    if (!send_message(handle, 12, 0, body, false) || !receive_message(handle, type, request_id, body, false)) {
+      return false;
+    }
+
+    return type == 13 && body.size() == 4 && (*(uint32_t*) &body[0] & 0x01) != 0;
+  }
+
+  // Open loop: each request has an intended send time from the target rate, and latency is measured from that, so
+  // a stalled server shows up as latency instead of quietly lowering the request rate
+  void send_loop(load_clock::time_point start, load_clock::time_point end) {
+    auto interval = std::chrono::duration_cast<load_clock::duration>(
+        std::chrono::duration<double>(options.connections / options.rate));
+
+    auto intended = start;
+
+    for (uint32_t request_id = 1; intended < end && !finished; request_id++, intended += interval) {
+      auto now = load_clock::now();
+
+      if (now < intended) {
+        std::this_thread::sleep_until(intended);
+      }
+
+      uint16_t type = pick_type();
+
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        pending[request_id] = { type, intended };
+      }
+
+      if (!send_message(handle, type, request_id, request_body(type), true)) {
+        fprintf(stderr, "Failed to send request.\n");
+        return;
+      }
+    }
+  }
+
+  void receive_loop(load_clock::time_point measure_from) {
+    uint16_t type = 0;
+    uint32_t request_id = 0;
+    std::vector<uint8_t> body;
+
+    while (receive_message(handle, type, request_id, body, true)) {
+      auto now = load_clock::now();
+      LoadRequest request {};
+
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = pending.find(request_id);
+
+        if (it == pending.end()) {
+          continue;
+        }
+
+        request = it->second;
+        pending.erase(it);
+      }
+
+      if (type == 1 || type == 2 || !decompress_response(type, body)) {
+        results.errors++;
+      } else if (request.intended >= measure_from) {
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.intended).count();
+        results.latencies[request.type].push_back(latency);
+        results.last_completion = now;
+      }
+    }
+
+    if (!finished) {
+      fprintf(stderr, "Connection closed by server.\n");
+    }
+  }
+
+  uint16_t pick_type() {
+    uint32_t value = std::uniform_int_distribution<uint32_t>(0, weights.back() - 1)(random);
+    size_t index = std::upper_bound(weights.begin(), weights.end(), value) - weights.begin();
+    return options.mix[index].first;
+  }
+
+  std::vector<uint8_t> request_body(uint16_t type) {
+    std::vector<uint8_t> body;
+
+    if (type == 7 && !handles.empty()) {
+      uint64_t handle = handles[std::uniform_int_distribution<size_t>(0, handles.size() - 1)(random)];
+      body.resize(sizeof(handle));
+      memcpy(&body[0], &handle, sizeof(handle));
+    } else if (type == 10) {
+      body.resize(4);
+      *(uint32_t*) &body[0] = std::uniform_int_distribution<uint32_t>(1, options.file_indices)(random);
+    }
+
+    return body;
+  }
+
+  const LoadOptions& options;
+  const std::vector<uint64_t>& handles;
+  std::mt19937 random;
+  std::vector<uint32_t> weights;
+  socket_handle handle = invalid_socket_handle;
+  std::atomic<bool> finished { false };
+  std::mutex mutex;
+  std::unordered_map<uint32_t, LoadRequest> pending;
+};
+
+// Client of the shared memory channel of loadgen_server --shared-memory, laid out as described in shared_channel.h.
+// Polls instead of using the server's events, which is slower but works the same everywhere.
+class SharedClient {
+public:
+  ~SharedClient() {
+    if (base == nullptr) {
+      return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(mapping);
+#else
+    munmap(base, size);
+#endif
+  }
+
+  bool open(const std::string& name) {
+#ifdef _WIN32
+    std::string path = "Local\\" + name;
+    mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+
+    if (mapping == nullptr) {
+      return false;
+    }
+
+    base = (uint8_t*) MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+    if (base == nullptr) {
+      CloseHandle(mapping);
+      return false;
+    }
+#else
+    std::string path = "/" + name;
+    int handle = shm_open(path.c_str(), O_RDWR, 0);
+    struct stat status {};
+
+    if (handle < 0) {
+      return false;
+    } else if (fstat(handle, &status) != 0 || status.st_size < 0x200) {
+      close(handle);
+      return false;
+    }
+
+    size = (size_t) status.st_size;
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    close(handle);
+
+    if (view == MAP_FAILED) {
+      return false;
+    }
+
+    base = (uint8_t*) view;
+#endif
+
+    capacity = *(uint32_t*) &base[4];
+    requests = { shared_atomic<uint64_t>(0xC0), shared_atomic<uint64_t>(0x100), base + 0x200 };
+    responses = { shared_atomic<uint64_t>(0x140), shared_atomic<uint64_t>(0x180), base + 0x200 + capacity };
+
+    return shared_atomic<uint32_t>(0)->load(std::memory_order_acquire) == 0x4D485357 && capacity > 0;
+  }
+
+  // Starts a new session, which drops whatever the server was doing for the previous one
+  bool attach(uint32_t session) {
+    shared_atomic<uint32_t>(0x40)->store(session, std::memory_order_release);
+
+    return wait_until([this, session] {
+      return shared_atomic<uint32_t>(0x80)->load(std::memory_order_acquire) == session;
+    });
+  }
+
+  bool send(uint16_t type, const std::vector<uint8_t>& body) {
+    uint8_t header[6];
+    *(uint16_t*) &header[0] = type;
+    *(uint32_t*) &header[2] = body.size();
+
+    return write(header, sizeof(header)) && write(body.data(), body.size());
+  }
+
+  bool receive(uint16_t& type, std::vector<uint8_t>& body) {
+    uint8_t header[6];
+
+    if (!read(header, sizeof(header))) {
+      return false;
+    }
+
+    type = *(uint16_t*) &header[0];
+    body.resize(*(uint32_t*) &header[2]);
+    return read(body.data(), body.size());
+  }
+
+  uint32_t ring_capacity() const {
+    return capacity;
+  }
+
+  // Bytes which went through both rings in the current session
+  uint64_t transferred() const {
+    return requests.write_position->load() + responses.read_position->load();
+  }
+
+private:
+  struct Ring {
+    std::atomic<uint64_t>* write_position;
+    std::atomic<uint64_t>* read_position;
+    uint8_t* data;
+  };
+
+  template <typename T>
+  std::atomic<T>* shared_atomic(size_t offset) {
+    return reinterpret_cast<std::atomic<T>*>(base + offset);
+  }
+
+  // Gives up after a few seconds, as the server never takes that long without being stuck
+  template <typename Condition>
+  static bool wait_until(Condition condition) {
+    auto deadline = load_clock::now() + std::chrono::seconds(5);
+
+    while (!condition()) {
+      if (load_clock::now() >= deadline) {
+        return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    return true;
+  }
+
+  bool write(const uint8_t* data, size_t length) {
+    while (length > 0) {
+      uint64_t position = requests.write_position->load(std::memory_order_relaxed);
+
+      if (!wait_until([&] { return position - requests.read_position->load(std::memory_order_acquire) < capacity; })) {
+        return false;
+      }
+
+      uint64_t space = capacity - (position - requests.read_position->load(std::memory_order_acquire));
+      size_t offset = position % capacity;
+      size_t count = std::min<uint64_t>(std::min<uint64_t>(space, length), capacity - offset);
+
+      memcpy(&requests.data[offset], data, count);
+      requests.write_position->store(position + count, std::memory_order_release);
+
+      data += count;
+      length -= count;
+    }
+
+    return true;
+  }
+
+  bool read(uint8_t* data, size_t length) {
+    while (length > 0) {
+      uint64_t position = responses.read_position->load(std::memory_order_relaxed);
+
+      if (!wait_until([&] { return responses.write_position->load(std::memory_order_acquire) != position; })) {
+        return false;
+      }
+
+      uint64_t available = responses.write_position->load(std::memory_order_acquire) - position;
+      size_t offset = position % capacity;
+      size_t count = std::min<uint64_t>(std::min<uint64_t>(available, length), capacity - offset);
+
+      memcpy(data, &responses.data[offset], count);
+      responses.read_position->store(position + count, std::memory_order_release);
+
+      data += count;
+      length -= count;
+    }
+
+    return true;
+  }
+
+#ifdef _WIN32
+  HANDLE mapping = nullptr;
+#endif
+  uint8_t* base = nullptr;
+  size_t size = 0;
+  uint32_t capacity = 0;
+  Ring requests {};
+  Ring responses {};
+};
+
+// Receives a response, putting it back together if it was streamed as type 3 and 4 frames
+static bool receive_response(SharedClient& client, uint16_t& type, std::vector<uint8_t>& body) {
+  if (!client.receive(type, body)) {
+    return false;
+  } else if (type != 3) {
+    return true;
+  } else if (body.size() != 2) {
+    return false;
+  }
+
+  type = *(uint16_t*) &body[0];
+  body.clear();
+
+  uint16_t frame_type = 0;
+  std::vector<uint8_t> chunk;
+
+  while (client.receive(frame_type, chunk) && frame_type == 4) {
+    if (chunk.empty()) {
+      return true;
+    }
+
+    body.insert(body.end(), chunk.begin(), chunk.end());
+  }
+
+  return false;
+}
+
+static bool shared_exchange(SharedClient& client, uint16_t type, const std::vector<uint8_t>& request,
+                            uint16_t expected_type, const std::vector<uint8_t>& expected) {
+
+  uint16_t response_type = 0;
+  std::vector<uint8_t> response;
+
+  return client.send(type, request) && receive_response(client, response_type, response) &&
+      response_type == expected_type && response == expected;
+}
+
+static std::vector<uint8_t> file_path_request(uint32_t file_index, size_t size) {
+  std::vector<uint8_t> body(std::max(size, sizeof(file_index)));
+  memcpy(&body[0], &file_index, sizeof(file_index));
+  return body;
+}
+
+// Checks the shared memory channel against the same requests over TCP: wraps the rings many times, sends a request
+// and a response larger than a ring, and attaches new sessions, once while the server is stuck on a response the
+// previous session never read. A new session must not keep the streaming the previous one negotiated.
+static bool check_shared_memory(const LoadOptions& options) {
+  std::vector<uint8_t> list;
+  std::vector<std::vector<uint8_t>> paths(16);
+  uint16_t type = 0;
+
+  if (!exchange_message(options, 5, std::vector<uint8_t>(), type, list) || type != 6) {
+    fprintf(stderr, "Failed to fetch the emitter list from %s:%s.\n", options.host.c_str(), options.port.c_str());
+    return false;
+  }
+
+  for (uint32_t i = 0; i < paths.size(); i++) {
+    if (!exchange_message(options, 10, file_path_request(i + 1, 4), type, paths[i]) || type != 11) {
+      fprintf(stderr, "Failed to fetch file paths from %s:%s.\n", options.host.c_str(), options.port.c_str());
+      return false;
+    }
+  }
+
+  SharedClient client;
+
+  if (!client.open(options.shared_memory)) {
+    fprintf(stderr, "Failed to open shared memory channel %s.\n", options.shared_memory.c_str());
+    return false;
+  }
+
+  uint32_t capacity = client.ring_capacity();
+  // Sessions of an earlier run may still be known to the server, so these start somewhere else every time
+  auto session = (uint32_t) (load_clock::now().time_since_epoch().count() | 1);
+  std::vector<uint8_t> streaming(4);
+  *(uint32_t*) &streaming[0] = 0x02;
+
+  if (!client.attach(session) || !shared_exchange(client, 12, streaming, 13, streaming)) {
+    fprintf(stderr, "Failed to attach and negotiate streaming.\n");
+    return false;
+  }
+
+  uint64_t wraps = 0;
+
+  for (uint32_t i = 0; client.transferred() < 8 * (uint64_t) capacity || i < paths.size(); i++) {
+    if (!shared_exchange(client, 5, std::vector<uint8_t>(), 6, list) ||
+        !shared_exchange(client, 10, file_path_request(i % paths.size() + 1, 4), 11, paths[i % paths.size()])) {
+      fprintf(stderr, "Streamed responses differ from TCP after %llu bytes.\n",
+              (unsigned long long) client.transferred());
+      return false;
+    }
+
+    wraps = client.transferred() / capacity;
+  }
+
+  if (!shared_exchange(client, 10, file_path_request(3, 3 * (size_t) capacity), 11, paths[2])) {
+    fprintf(stderr, "Request larger than the ring failed.\n");
+    return false;
+  }
+
+  // Without negotiating again, the list has to come back as one type 6 message larger than the ring
+  uint16_t response_type = 0;
+  std::vector<uint8_t> response;
+
+  if (!client.attach(session + 2) || !client.send(5, std::vector<uint8_t>()) ||
+      !client.receive(response_type, response) || response_type != 6 || response != list) {
+    fprintf(stderr, "New session did not get an unstreamed emitter list, type %u.\n", response_type);
+    return false;
+  }
+
+  // Leaves the server blocked on a response nobody reads, the next session has to get through anyway
+  if (!client.attach(session + 4) || !client.send(5, std::vector<uint8_t>())) {
+    fprintf(stderr, "Failed to start the abandoned session.\n");
+    return false;
+  }
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  if (!client.attach(session + 6) || !shared_exchange(client, 10, file_path_request(1, 4), 11, paths[0])) {
+    fprintf(stderr, "Reattaching after an abandoned session failed.\n");
+    return false;
+  }
+
+  printf("Shared memory channel %s: ring capacity %u, wrapped at least %llu times, list of %zu bytes, all checks "
+         "passed.\n", options.shared_memory.c_str(), capacity, (unsigned long long) wraps, list.size());
+  return true;
+}
+
+// Asks for the same responses with and without compression, the compressed ones must decompress to the same bytes
+static bool check_compression(const LoadOptions& options, const std::vector<uint64_t>& handles) {
+  std::vector<std::pair<uint16_t, std::vector<uint8_t>>> requests;
+  requests.push_back({ 5, std::vector<uint8_t>() });
+  requests.push_back({ 10, file_path_request(1, 64) });
+
+  if (!handles.empty()) {
+    std::vector<uint8_t> body(sizeof(handles[0]));
+    memcpy(&body[0], &handles[0], sizeof(handles[0]));
+    requests.push_back({ 7, body });
+  }
+
+  socket_handle handle = socket_connect(options);
+  std::vector<uint8_t> options_body(4);
+  *(uint32_t*) &options_body[0] = 0x04;
+
+  uint16_t type = 0;
+  uint32_t request_id = 0;
+
+  if (handle == invalid_socket_handle || !send_message(handle, 12, 0, options_body, false) ||
+      !receive_message(handle, type, request_id, options_body, false) || type != 13 ||
+      options_body.size() != 4 || (*(uint32_t*) &options_body[0] & 0x04) == 0) {
+    fprintf(stderr, "Failed to negotiate compression.\n");
+    socket_close(handle);
+    return false;
+  }
+
+  uint32_t compressed = 0;
+
+  for (const auto& request : requests) {
+    uint16_t expected_type = 0;
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> response;
+
+    if (!exchange_message(options, request.first, request.second, expected_type, expected) ||
+        !send_message(handle, request.first, 0, request.second, false) ||
+        !receive_message(handle, type, request_id, response, false)) {
+      fprintf(stderr, "Failed to fetch message type %u for the compression check.\n", request.first);
+      socket_close(handle);
+      return false;
+    }
+
+    compressed += type == 9 ? 1 : 0;
+
+    if (!decompress_response(type, response) || type != expected_type || response != expected) {
+      fprintf(stderr, "Compressed response to message type %u differs from the uncompressed one.\n", request.first);
+      socket_close(handle);
+      return false;
+    }
+  }
+
+  socket_close(handle);
+
+  if (compressed == 0) {
+    fprintf(stderr, "No response came back compressed.\n");
+    return false;
+  }
+
+  printf("Compression: %u of %zu responses compressed, all decompress to the uncompressed ones.\n", compressed,
+         requests.size());
+  return true;
+}
+
+static double percentile(const std::vector<uint64_t>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+
+  size_t index = std::min(sorted.size() - 1, (size_t) (fraction * sorted.size()));
+  return sorted[index] / 1000.0;
+}
+
+// Rates are over the time until the last measured response, which is longer than the window when the server lags
+// Returns the number of failed requests
+static uint64_t report(const LoadOptions& options, const std::vector<std::unique_ptr<LoadConnection>>& connections,
+                       load_clock::time_point measure_from) {
+
+  std::unordered_map<uint16_t, std::vector<uint64_t>> by_type;
+  std::vector<uint64_t> all;
+  uint64_t errors = 0;
+  auto last_completion = measure_from;
+
+  for (const auto& connection : connections) {
+    errors += connection->results.errors;
+    last_completion = std::max(last_completion, connection->results.last_completion);
+
+    for (const auto& it : connection->results.latencies) {
+      auto& latencies = by_type[it.first];
+      latencies.insert(latencies.end(), it.second.begin(), it.second.end());
+      all.insert(all.end(), it.second.begin(), it.second.end());
+    }
+  }
+
+  double measured = std::max(options.duration - options.warmup,
+                             std::chrono::duration<double>(last_completion - measure_from).count());
+  std::vector<uint16_t> types;
+
+  for (auto& it : by_type) {
+    std::sort(it.second.begin(), it.second.end());
+    types.push_back(it.first);
+  }
+
+  std::sort(types.begin(), types.end());
+  std::sort(all.begin(), all.end());
+
+  printf("%-6s %10s %10s %10s %10s %10s %10s\n", "type", "requests", "req/s", "p50 us", "p99 us", "p999 us", "max us");
+
+  auto print_row = [measured] (const char* name, const std::vector<uint64_t>& latencies) {
+    printf("%-6s %10zu %10.0f %10.1f %10.1f %10.1f %10.1f\n", name, latencies.size(), latencies.size() / measured,
+           percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+  };
+
+  for (uint16_t type : types) {
+    print_row(std::to_string(type).c_str(), by_type[type]);
+  }
+
+  print_row("all", all);
+  printf("errors %llu\n", (unsigned long long) errors);
+
+  if (!options.csv.empty()) {
+    FILE* file = fopen(options.csv.c_str(), "a");
+
+    if (file != nullptr) {
+      fprintf(file, "%lld,%.0f,%u,%zu,%.0f,%.1f,%.1f,%.1f,%llu\n", (long long) time(nullptr), options.rate,
+              options.connections, all.size(), all.size() / measured, percentile(all, 0.5), percentile(all, 0.99),
+              percentile(all, 0.999), (unsigned long long) errors);
+      fclose(file);
+    }
+  }
+
+  return errors;
+}
+
+static bool parse_mix(const std::string& text, std::vector<std::pair<uint16_t, uint32_t>>& mix) {
+  mix.clear();
+  size_t position = 0;
+
+  while (position < text.size()) {
+    size_t end = text.find(',', position);
+    std::string entry = text.substr(position, end == std::string::npos ? std::string::npos : end - position);
+    size_t separator = entry.find(':');
+
+    uint16_t type = (uint16_t) std::stoul(entry.substr(0, separator));
+    uint32_t weight = separator == std::string::npos ? 1 : (uint32_t) std::stoul(entry.substr(separator + 1));
+
+    if (type != 5 && type != 7 && type != 10) {
+      return false;
+    } else if (weight > 0) {
+      mix.emplace_back(type, weight);
+    }
+
+    position = end == std::string::npos ? text.size() : end + 1;
+  }
+
+  return !mix.empty();
+}
+
+static void print_usage() {
+  fprintf(stderr,
+      "Usage: loadgen [options]\n"
+      "  --host HOST          server host (127.0.0.1)\n"
+      "  --port PORT          server port (3548)\n"
+      "  --connections N      parallel connections (4)\n"
+      "  --rate N             target requests per second over all connections (10000)\n"
+      "  --duration SECONDS   total run time including warmup (10)\n"
+      "  --warmup SECONDS     leading time excluded from the results (2)\n"
+      "  --mix TYPE:WEIGHT,.. message types 5, 7 and 10 with relative weights (5:1,7:8,10:8)\n"
+      "  --file-indices N     file indices for message 10 are drawn from 1 to N (10000)\n"
+      "  --compression        negotiate response compression\n"
+      "  --csv FILE           append a summary line to FILE\n"
+      "  --shared-memory NAME check the shared memory channel NAME against TCP instead of generating load\n"
+      "Exits with status 1 if any request failed or a check did not pass.\n");
+}
+
+static bool parse_options(int argc, char** argv, LoadOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    std::string name = argv[i];
+
+    if (name == "--compression") {
+      options.compression = true;
+      continue;
+    } else if (i + 1 >= argc) {
+      return false;
+    }
+
+    std::string value = argv[++i];
+
+    try {
+      if (name == "--host") {
+        options.host = value;
+      } else if (name == "--port") {
+        options.port = value;
+      } else if (name == "--connections") {
+        options.connections = std::max(1ul, std::stoul(value));
+      } else if (name == "--rate") {
+        options.rate = std::stod(value);
+      } else if (name == "--duration") {
+        options.duration = std::stod(value);
+      } else if (name == "--warmup") {
+        options.warmup = std::stod(value);
+      } else if (name == "--mix") {
+        if (!parse_mix(value, options.mix)) {
+          return false;
+        }
+      } else if (name == "--file-indices") {
+        options.file_indices = std::max(1ul, std::stoul(value));
+      } else if (name == "--csv") {
+        options.csv = value;
+      } else if (name == "--shared-memory") {
+        options.shared_memory = value;
+      } else {
+        return false;
+      }
+    } catch (const std::exception& error) {
+      return false;
+    }
+  }
+
+  return options.rate > 0 && options.duration > options.warmup && options.warmup >= 0;
+}
+
+int main(int argc, char** argv) {
+  LoadOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    print_usage();
+    return 1;
+  }
+
+#ifdef _WIN32
+  WSADATA wsa_data;
+  WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#endif
+
+  if (!options.shared_memory.empty()) {
+    return check_shared_memory(options) ? 0 : 1;
+  }
+
+  std::vector<uint64_t> handles;
+
+  if (!load_emitter_handles(options, handles)) {
+    fprintf(stderr, "Failed to fetch the emitter list from %s:%s.\n", options.host.c_str(), options.port.c_str());
+    return 1;
+  }
+
+  if (options.compression && !check_compression(options, handles)) {
+    return 1;
+  }
+
+  printf("%zu emitters, %u connections, target %.0f req/s for %.1f s after %.1f s warmup\n", handles.size(),
+         options.connections, options.rate, options.duration - options.warmup, options.warmup);
+
+  std::vector<std::unique_ptr<LoadConnection>> connections;
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> failures { 0 };
+
+  auto start = load_clock::now() + std::chrono::milliseconds(100);
+  auto measure_from = start + std::chrono::duration_cast<load_clock::duration>(
+      std::chrono::duration<double>(options.warmup));
+  auto end = start + std::chrono::duration_cast<load_clock::duration>(
+      std::chrono::duration<double>(options.duration));
+
+  for (uint32_t i = 0; i < options.connections; i++) {
+    connections.push_back(std::make_unique<LoadConnection>(options, handles, i + 1));
+  }
+
+  for (const auto& connection : connections) {
+    threads.emplace_back([&connection, &failures, start, measure_from, end] {
+      if (!connection->run(start, measure_from, end)) {
+        failures++;
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Scripts tell a failed run by the exit status, so failed requests fail the run as much as failed connections
+  uint64_t errors = report(options, connections, measure_from);
+  return failures > 0 || errors > 0 ? 1 : 0;
+}
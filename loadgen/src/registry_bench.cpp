@@ -0,0 +1,269 @@
+#include "emitter_registry.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <unordered_set>
+
+// Simulates the hooks of a scene streaming emitters in and out on several engine threads while handler threads list
+// the emitters and look up details and the game loop drains events, once with a single shard like the old global lock
+// and once sharded. Reports the hook throughput and how long single hook calls took. The game loop also follows the
+// changes like a client of message 28 would and checks that it ends up with the same emitters as the registry.
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOptions {
+  uint32_t hook_threads = 4;
+  uint32_t handler_threads = 2;
+  uint32_t emitters = 20000;
+  uint32_t shards = 16;
+  uint32_t change_log = 65536;
+  uint32_t milliseconds = 2000;
+};
+
+struct BenchResult {
+  uint64_t hook_calls = 0;
+  uint64_t handler_calls = 0;
+  std::vector<uint32_t> latencies;
+  uint64_t delta_polls = 0;
+  uint64_t full_polls = 0;
+  bool consistent = true;
+};
+
+// Addresses are never dereferenced, they only need to be distinct and aligned like real objects
+template <class Type>
+static Type* fake_address(uint64_t thread, uint64_t index, uint64_t kind) {
+  return reinterpret_cast<Type*>(((thread + 1) << 40) | (kind << 36) | (index * 0x4A0));
+}
+
+static BenchResult run_bench(const BenchOptions& options, uint32_t shards) {
+  EmitterRegistry registry(shards, options.emitters / shards + 64, options.change_log);
+  std::atomic<bool> running(true);
+  std::atomic<bool> consistent(true);
+  BenchResult result;
+
+  // The scene which stays loaded, the hooks stream other emitters in and out on top of it
+  std::vector<uint64_t> handles;
+
+  for (uint32_t i = 0; i < options.emitters; i++) {
+    auto emitter = fake_address<WParticleEmitter>(0xFF, i, 1);
+    auto render_emitter = fake_address<WRenderParticleEmitter>(0xFF, i, 2);
+
+    registry.track_emitter(emitter, i);
+    handles.push_back(registry.register_render_emitter(render_emitter, emitter).handle);
+  }
+
+  std::vector<uint8_t> events;
+  uint64_t created = registry.drain_events(events);
+  uint64_t destroyed = 0;
+  events.clear();
+
+  std::vector<std::thread> threads;
+  std::vector<uint64_t> hook_calls(options.hook_threads);
+  std::vector<std::vector<uint32_t>> latencies(options.hook_threads);
+  std::atomic<uint64_t> handler_calls(0);
+
+  for (uint32_t thread = 0; thread < options.hook_threads; thread++) {
+    threads.emplace_back([&, thread] {
+      uint64_t calls = 0;
+
+      for (uint64_t i = 0; running.load(std::memory_order_relaxed); i++) {
+        auto emitter = fake_address<WParticleEmitter>(thread, i % 4096, 1);
+        auto render_emitter = fake_address<WRenderParticleEmitter>(thread, i % 4096, 2);
+        auto start = bench_clock::now();
+
+        registry.track_emitter(emitter, (uint32_t) i);
+        registry.register_render_emitter(render_emitter, emitter);
+        registry.unregister_render_emitter(render_emitter);
+        registry.untrack_emitter(emitter);
+
+        // Timing every cycle would mostly measure the clock, a cycle is four hook calls
+        if (i % 16 == 0) {
+          auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+          latencies[thread].push_back((uint32_t) std::min<int64_t>(elapsed.count() / 4, UINT32_MAX));
+        }
+
+        calls += 4;
+      }
+
+      hook_calls[thread] = calls;
+    });
+  }
+
+  for (uint32_t thread = 0; thread < options.handler_threads; thread++) {
+    threads.emplace_back([&, thread] {
+      std::mt19937 random(thread + 1);
+
+      while (running.load(std::memory_order_relaxed)) {
+        if (registry.render_emitters().size() < handles.size()) {
+          consistent = false;
+        }
+
+        for (int i = 0; i < 100; i++) {
+          uint64_t handle = handles[std::uniform_int_distribution<size_t>(0, handles.size() - 1)(random)];
+
+          if (!registry.with_render_emitter(handle, [] (const TrackedRenderParticleEmitter& emitter) { })) {
+            consistent = false;
+          }
+        }
+
+        handler_calls.fetch_add(101, std::memory_order_relaxed);
+      }
+    });
+  }
+
+  // The game loop, draining the events of every frame
+  auto count_events = [&events, &created, &destroyed] (uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+      (events[i * 13] != 0 ? created : destroyed)++;
+    }
+
+    events.clear();
+  };
+
+  std::unordered_set<uint64_t> client_handles;
+  std::vector<EmitterChange> changes;
+  uint64_t client_version = 0;
+
+  auto poll_changes = [&] {
+    uint64_t version = registry.version();
+    changes.clear();
+
+    if (registry.changes_since(client_version, version, changes)) {
+      for (const EmitterChange& change : changes) {
+        if (change.added) {
+          client_handles.insert(change.handle);
+        } else {
+          client_handles.erase(change.handle);
+        }
+      }
+
+      result.delta_polls++;
+    } else {
+      client_handles.clear();
+
+      for (const TrackedRenderParticleEmitter& emitter : registry.render_emitters()) {
+        client_handles.insert(emitter.handle);
+      }
+
+      result.full_polls++;
+    }
+
+    client_version = version;
+  };
+
+  auto end = bench_clock::now() + std::chrono::milliseconds(options.milliseconds);
+
+  while (bench_clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    count_events(registry.drain_events(events));
+    poll_changes();
+  }
+
+  running = false;
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  count_events(registry.drain_events(events));
+  poll_changes();
+
+  std::vector<uint64_t> remaining;
+
+  for (const TrackedRenderParticleEmitter& emitter : registry.render_emitters()) {
+    remaining.push_back(emitter.handle);
+  }
+
+  std::sort(remaining.begin(), remaining.end());
+  std::sort(handles.begin(), handles.end());
+
+  std::vector<uint64_t> followed(client_handles.begin(), client_handles.end());
+  std::sort(followed.begin(), followed.end());
+
+  if (remaining != handles || followed != handles || created != destroyed + handles.size()) {
+    consistent = false;
+  }
+
+  result.consistent = consistent;
+
+  for (uint32_t thread = 0; thread < options.hook_threads; thread++) {
+    result.hook_calls += hook_calls[thread];
+    result.latencies.insert(result.latencies.end(), latencies[thread].begin(), latencies[thread].end());
+  }
+
+  result.handler_calls = handler_calls;
+  std::sort(result.latencies.begin(), result.latencies.end());
+  return result;
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    uint32_t value;
+
+    try {
+      value = (uint32_t) std::max(1ul, std::stoul(argv[i + 1]));
+    } catch (const std::exception& error) {
+      return false;
+    }
+
+    if (name == "--hook-threads") {
+      options.hook_threads = value;
+    } else if (name == "--handler-threads") {
+      options.handler_threads = value;
+    } else if (name == "--emitters") {
+      options.emitters = value;
+    } else if (name == "--shards") {
+      options.shards = value;
+    } else if (name == "--change-log") {
+      options.change_log = value;
+    } else if (name == "--duration") {
+      options.milliseconds = value;
+    } else {
+      return false;
+    }
+  }
+
+  return argc % 2 == 1;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    fprintf(stderr, "Usage: registry_bench [--hook-threads N] [--handler-threads N] [--emitters N] [--shards N] "
+                    "[--change-log N] [--duration MS]\n");
+    return 1;
+  }
+
+  printf("%u hook threads, %u handler threads, %u emitters loaded, %u ms\n", options.hook_threads,
+         options.handler_threads, options.emitters, options.milliseconds);
+  printf("shards    hooks/s  handlers/s     p50 ns     p99 ns    p999 ns     max ns  delta  full\n");
+
+  for (uint32_t shards : { 1u, options.shards }) {
+    BenchResult result = run_bench(options, shards);
+
+    if (!result.consistent) {
+      fprintf(stderr, "Registry lost or kept emitters it should not have with %u shards.\n", shards);
+      return 1;
+    }
+
+    auto percentile = [&result] (double fraction) {
+      return result.latencies.empty() ? 0 : result.latencies[(size_t) (fraction * (result.latencies.size() - 1))];
+    };
+
+    double seconds = options.milliseconds / 1000.0;
+
+    printf("%6u %10.0f %11.0f %10u %10u %10u %10u %6llu %5llu\n", shards, result.hook_calls / seconds,
+           result.handler_calls / seconds, percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0),
+           (unsigned long long) result.delta_polls, (unsigned long long) result.full_polls);
+  }
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "text/utf8.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <locale>
+#include <codecvt>
+#include <algorithm>
+
+// Checks the UTF-8 transcoder against a plain per-character reference on random strings around the block sizes of the
+// vectorized path, then times it against the std::wstring_convert based conversion which the logger used before.
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOptions {
+  uint32_t strings = 4096;
+  uint32_t length = 64;
+  uint32_t iterations = 200;
+};
+
+static void reference_write(std::string& output, uint32_t code_point) {
+  if (code_point < 0x80) {
+    output.push_back((char) code_point);
+  } else if (code_point < 0x800) {
+    output.push_back((char) (0xC0 | (code_point >> 6)));
+    output.push_back((char) (0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    output.push_back((char) (0xE0 | (code_point >> 12)));
+    output.push_back((char) (0x80 | ((code_point >> 6) & 0x3F)));
+    output.push_back((char) (0x80 | (code_point & 0x3F)));
+  } else {
+    output.push_back((char) (0xF0 | (code_point >> 18)));
+    output.push_back((char) (0x80 | ((code_point >> 12) & 0x3F)));
+    output.push_back((char) (0x80 | ((code_point >> 6) & 0x3F)));
+    output.push_back((char) (0x80 | (code_point & 0x3F)));
+  }
+}
+
+static std::string reference_utf16(const std::u16string& input) {
+  std::string output;
+
+  for (size_t i = 0; i < input.length(); i++) {
+    uint32_t unit = input[i];
+    bool high = unit >= 0xD800 && unit <= 0xDBFF;
+    bool low = unit >= 0xDC00 && unit <= 0xDFFF;
+
+    if (high && i + 1 < input.length() && input[i + 1] >= 0xDC00 && input[i + 1] <= 0xDFFF) {
+      reference_write(output, 0x10000 + ((unit - 0xD800) << 10) + (input[i + 1] - 0xDC00));
+      i++;
+    } else if (high || low) {
+      reference_write(output, 0xFFFD);
+    } else {
+      reference_write(output, unit);
+    }
+  }
+
+  return output;
+}
+
+// Mostly ASCII with some of every other encoded length mixed in, plus unpaired surrogates when asked for
+static std::u16string generate_utf16(std::mt19937& random, size_t length, bool unpaired) {
+  std::uniform_int_distribution<uint32_t> kinds(0, 15);
+  std::uniform_int_distribution<uint32_t> ascii(0x01, 0x7F);
+  std::uniform_int_distribution<uint32_t> two_byte(0x80, 0x7FF);
+  std::uniform_int_distribution<uint32_t> three_byte(0x800, 0xD7FF);
+  std::uniform_int_distribution<uint32_t> surrogate(0, 0x3FF);
+  std::u16string result;
+
+  while (result.length() < length) {
+    uint32_t kind = kinds(random);
+
+    if (kind < 10) {
+      result.push_back((char16_t) ascii(random));
+    } else if (kind < 12) {
+      result.push_back((char16_t) two_byte(random));
+    } else if (kind < 14) {
+      result.push_back((char16_t) three_byte(random));
+    } else if (kind == 14 || !unpaired) {
+      result.push_back((char16_t) (0xD800 + surrogate(random)));
+      result.push_back((char16_t) (0xDC00 + surrogate(random)));
+    } else {
+      result.push_back((char16_t) ((random() & 1 ? 0xD800 : 0xDC00) + surrogate(random)));
+    }
+  }
+
+  return result;
+}
+
+static std::wstring to_wide(const std::u16string& input) {
+  std::wstring result;
+
+  if (sizeof(wchar_t) == 2) {
+    result.assign(input.begin(), input.end());
+    return result;
+  }
+
+  for (size_t i = 0; i < input.length(); i++) {
+    uint32_t unit = input[i];
+
+    if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < input.length()) {
+      unit = 0x10000 + ((unit - 0xD800) << 10) + (input[++i] - 0xDC00);
+    }
+
+    result.push_back((wchar_t) unit);
+  }
+
+  return result;
+}
+
+static std::string convert_utf16(const std::u16string& input) {
+  std::string output(utf8_length_bound(input.length(), sizeof(char16_t)), '\0');
+  output.resize(utf8_from_utf16(input.data(), input.length(), &output[0]));
+  return output;
+}
+
+static bool check_conversions(std::mt19937& random) {
+  std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
+
+  for (size_t length = 0; length <= 40; length++) {
+    for (int round = 0; round < 200; round++) {
+      std::u16string input = generate_utf16(random, length, true);
+
+      if (convert_utf16(input) != reference_utf16(input)) {
+        fprintf(stderr, "UTF-16 conversion differs from the reference at length %zu.\n", input.length());
+        return false;
+      }
+
+      // With a 16-bit wchar_t codecvt_utf8 only knows UCS-2, so there the reference stands in for it
+      std::u16string valid = generate_utf16(random, length, false);
+      std::wstring wide = to_wide(valid);
+      std::string expected = sizeof(wchar_t) == 2 ? reference_utf16(valid) : converter.to_bytes(wide);
+      std::string converted;
+      utf8_append(converted, wide.data(), wide.length());
+
+      if (converted != expected) {
+        fprintf(stderr, "Wide conversion differs from wstring_convert at length %zu.\n", wide.length());
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+template <typename Function>
+static double bench_converter(const std::vector<std::wstring>& strings, uint32_t iterations, Function convert) {
+  auto start = bench_clock::now();
+  size_t total_bytes = 0;
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    for (const std::wstring& string : strings) {
+      total_bytes += convert(string).length();
+    }
+  }
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+
+  if (total_bytes == 0) {
+    fprintf(stderr, "Nothing was converted.\n");
+  }
+
+  return (double) elapsed.count() / ((double) iterations * strings.size());
+}
+
+static bool parse_options(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string name = argv[i];
+    uint32_t value;
+
+    try {
+      value = (uint32_t) std::max(1ul, std::stoul(argv[i + 1]));
+    } catch (const std::exception& error) {
+      return false;
+    }
+
+    if (name == "--strings") {
+      options.strings = value;
+    } else if (name == "--length") {
+      options.length = value;
+    } else if (name == "--iterations") {
+      options.iterations = value;
+    } else {
+      return false;
+    }
+  }
+
+  return argc % 2 == 1;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+
+  if (!parse_options(argc, argv, options)) {
+    fprintf(stderr, "Usage: utf8_bench [--strings N] [--length N] [--iterations N]\n");
+    return 1;
+  }
+
+  std::mt19937 random(1234);
+
+  if (!check_conversions(random)) {
+    return 1;
+  }
+
+  // File paths are nearly all ASCII, one in eight of them gets a non-ASCII name
+  std::vector<std::wstring> ascii_strings;
+  std::vector<std::wstring> mixed_strings;
+  std::uniform_int_distribution<uint32_t> ascii(0x20, 0x7E);
+
+  for (uint32_t i = 0; i < options.strings; i++) {
+    std::wstring path;
+
+    for (uint32_t j = 0; j < options.length; j++) {
+      path.push_back((wchar_t) ascii(random));
+    }
+
+    ascii_strings.push_back(path);
+
+    if (i % 8 == 0) {
+      path = to_wide(generate_utf16(random, options.length, false));
+    }
+
+    mixed_strings.push_back(path);
+  }
+
+  std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
+
+  auto convert_std = [&converter](const std::wstring& string) {
+    return converter.to_bytes(string);
+  };
+
+  auto convert_utf8 = [](const std::wstring& string) {
+    std::string result;
+    utf8_append(result, string.data(), string.length());
+    return result;
+  };
+
+  printf("%u strings, %u characters each, %u iterations\n", options.strings, options.length, options.iterations);
+  printf("strings  converter        ns/string\n");
+
+  for (auto* strings : { &ascii_strings, &mixed_strings }) {
+    const char* label = strings == &ascii_strings ? "ascii" : "mixed";
+
+    printf("%-8s %-10s %15.1f\n", label, "wstring", bench_converter(*strings, options.iterations, convert_std));
+    printf("%-8s %-10s %15.1f\n", label, "utf8", bench_converter(*strings, options.iterations, convert_utf8));
+  }
+
+  return 0;
+}